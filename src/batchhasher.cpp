@@ -0,0 +1,361 @@
+#include "batchhasher.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+
+#include <atomic>
+#include <cerrno>
+
+#include "trace.h"
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define DELIVERY_INTERVAL 50
+#define SMALL_FILE_LIMIT (256 * 1024)
+#define SMALL_BATCH_FILES 256
+#define SMALL_BATCH_BYTES (8 * 1024 * 1024)
+#define READAHEAD_FILES 16
+
+namespace {
+
+// Adds the progress of one file to the batch totals and holds the
+// worker back while the throttle is in debt.
+class FileMonitor : public HashMonitor
+{
+public:
+	FileMonitor( std::atomic<quint64> &doneBytes, const std::atomic<bool> &stop, Throttle &throttle )
+		: doneBytes( doneBytes ), stop( stop ), throttle( throttle ), reported( 0 )
+	{}
+
+	// Starts the next file with the bytes already charged for it.
+	void reset( quint64 charged )
+	{
+		reported = charged;
+	}
+
+	bool update( quint64 done ) override
+	{
+		if( done > reported ) {
+			doneBytes += done - reported;
+			throttle.acquire( done - reported, &stop );
+			reported = done;
+		}
+		return !stop;
+	}
+
+private:
+	std::atomic<quint64> &doneBytes;
+	const std::atomic<bool> &stop;
+	Throttle &throttle;
+	quint64 reported;
+};
+
+#ifdef Q_OS_UNIX
+// Reads a small file into memory and hashes it from there, usually with a
+// single read(). Files that grew beyond the buffer are streamed instead.
+QByteArray readAndHash( int fd, qint64 size, QByteArray &buf, const HashAlgorithm *algo, HashMonitor *monitor )
+{
+	qsizetype total = 0;
+	for( ;; ) {
+		const qsizetype wanted = buf.size() - total;
+		Trace::Span span( "read" );
+		const ssize_t nread = ::read( fd, buf.data() + total, std::size_t( wanted ) );
+		span.setArg( nread );
+		if( nread < 0 && errno == EINTR )
+			continue;
+		if( nread < 0 )
+			return QByteArray();
+		total += nread;
+		// Network and FUSE file systems may return short reads before the
+		// end, only 0 is EOF. Once the listed size is in, that extra
+		// read() is skipped.
+		if( nread == 0 || total == buf.size() || total == size )
+			break;
+	}
+
+	if( total < buf.size() )
+		return algo->hashBuffer( buf.constData(), total );
+
+	QFile file;
+	if( ::lseek( fd, 0, SEEK_SET ) != 0 || !file.open( fd, QIODevice::ReadOnly, QFileDevice::DontCloseHandle ) )
+		return QByteArray();
+	return algo->hash( &file, monitor );
+}
+#endif
+
+} // namespace
+
+class BatchHasher::Private {
+public:
+	Private()
+		: algorithm( HashAlgorithm::defaultAlgorithm() ), maxThreads( QThread::idealThreadCount() )
+	{}
+
+	QStringList inputs;
+	const HashAlgorithm *algorithm;
+	int maxThreads;
+
+	std::atomic<bool> stop { false };
+	std::atomic<quint64> doneBytes { 0 };
+	quint64 inputBytes = 0;
+
+	Throttle throttle;
+	std::atomic<int> priority { Throttle::NormalPriority };
+
+	QMutex pendingMutex;
+	QVector<HashResult> pending;
+};
+
+BatchHasher::BatchHasher( QObject *parent )
+	: QThread( parent ), d( new BatchHasher::Private() )
+{
+	qRegisterMetaType<HashResult>();
+	qRegisterMetaType<QVector<HashResult>>();
+}
+
+BatchHasher::~BatchHasher()
+{
+	stopProcess();
+	wait();
+	delete d;
+}
+
+void BatchHasher::setInput( const QStringList &paths )
+{
+	d->inputs = paths;
+}
+
+bool BatchHasher::setAlgorithm( const QString &name )
+{
+	const HashAlgorithm *algo = HashAlgorithm::find( name );
+	if( !algo )
+		return false;
+	d->algorithm = algo;
+	return true;
+}
+
+int BatchHasher::digestSize() const
+{
+	return d->algorithm->digestSize;
+}
+
+void BatchHasher::setMaxThreads( int count )
+{
+	d->maxThreads = count > 0 ? count : QThread::idealThreadCount();
+}
+
+void BatchHasher::setPriority( Throttle::Priority priority )
+{
+	d->priority = priority;
+}
+
+void BatchHasher::setBandwidthLimit( double mbps )
+{
+	d->throttle.setLimit( mbps );
+}
+
+double BatchHasher::bandwidthLimit() const
+{
+	return d->throttle.limit();
+}
+
+double BatchHasher::effectiveRate() const
+{
+	return d->throttle.effectiveRate();
+}
+
+void BatchHasher::stopProcess()
+{
+	d->stop = true;
+}
+
+void BatchHasher::applyPriority()
+{
+	// Workers pick up priority changes with their next task.
+	Throttle::setCurrentThreadPriority( Throttle::Priority( d->priority.load() ) );
+}
+
+void BatchHasher::run()
+{
+	d->stop = false;
+	d->doneBytes = 0;
+	d->inputBytes = 0;
+
+	QThreadPool pool;
+	pool.setMaxThreadCount( d->maxThreads );
+
+	Trace::setThreadName( "BatchHasher" );
+
+	auto deliver = [this]() {
+		Trace::Span span( "deliver" );
+		QVector<HashResult> batch;
+		{
+			QMutexLocker locker( &d->pendingMutex );
+			batch.swap( d->pending );
+		}
+		if( !batch.isEmpty() )
+			emit resultsReady( batch );
+		if( d->inputBytes )
+			emit progressChanged( (float)d->doneBytes / d->inputBytes );
+		emit throughputChanged( d->throttle.effectiveRate(), d->throttle.limit() );
+	};
+
+	// Small files are handed to the workers in batches, so the per-file
+	// cost is a few syscalls instead of a task, a QFile and a buffer.
+	QVector<FileEntry> smallFiles;
+	qint64 smallBytes = 0;
+	auto queueSmallFiles = [&]() {
+		if( smallFiles.isEmpty() )
+			return;
+		const quint64 queued = Trace::timestamp();
+		pool.start( [this, queued, batch = std::move( smallFiles )]() {
+			if( queued )
+				Trace::record( "queue wait", queued );
+			hashSmallFiles( batch );
+		} );
+		smallFiles.clear();
+		smallBytes = 0;
+	};
+
+	// Queue files while walking, so hashing starts with the first file found.
+	QElapsedTimer timer;
+	timer.start();
+	FileWalker::walk( d->inputs, [&]( const FileEntry &entry ) {
+		d->inputBytes += entry.size;
+		if( entry.size <= SMALL_FILE_LIMIT ) {
+			smallFiles.append( entry );
+			smallBytes += entry.size;
+			if( smallFiles.size() >= SMALL_BATCH_FILES || smallBytes >= SMALL_BATCH_BYTES )
+				queueSmallFiles();
+		} else {
+			const quint64 queued = Trace::timestamp();
+			pool.start( [this, entry, queued]() {
+				if( queued )
+					Trace::record( "queue wait", queued );
+				hashFile( entry.path, entry.size );
+			} );
+		}
+		if( timer.elapsed() >= DELIVERY_INTERVAL ) {
+			deliver();
+			timer.restart();
+		}
+		return !d->stop;
+	} );
+	queueSmallFiles();
+
+	while( !pool.waitForDone( DELIVERY_INTERVAL ) )
+		deliver();
+	deliver();
+
+	emit progressChanged( d->stop ? 0.0f : 1.0f );
+}
+
+void BatchHasher::hashFile( const QString &path, qint64 size )
+{
+	if( d->stop )
+		return;
+
+	applyPriority();
+	Trace::Span span( "file", size );
+
+	HashResult result;
+	result.path = path;
+	result.size = size;
+
+	QFile file( path );
+	bool opened = false;
+	{
+		Trace::Span span( "open" );
+		opened = file.open( QIODevice::ReadOnly | QIODevice::Unbuffered );
+	}
+	if( opened ) {
+		FileMonitor monitor( d->doneBytes, d->stop, d->throttle );
+		result.digest = d->algorithm->hash( &file, &monitor );
+	}
+
+	if( d->stop )
+		return;
+
+	Trace::Span publish( "publish" );
+	QMutexLocker locker( &d->pendingMutex );
+	d->pending.append( result );
+}
+
+void BatchHasher::hashSmallFiles( const QVector<FileEntry> &files )
+{
+	// Whole files are read into a buffer that every worker thread reuses.
+	thread_local QByteArray buf;
+	if( buf.size() != SMALL_FILE_LIMIT + 1 )
+		buf.resize( SMALL_FILE_LIMIT + 1 );
+
+	applyPriority();
+	Trace::Span span( "small files" );
+
+	QVector<HashResult> results;
+	results.reserve( files.size() );
+	FileMonitor monitor( d->doneBytes, d->stop, d->throttle );
+
+#ifdef Q_OS_UNIX
+	// Open the next files early and let the kernel start reading them
+	// while the current one is hashed.
+	QVector<int> fds( files.size(), -1 );
+	auto prefetch = [&]( int i ) {
+		if( i >= files.size() || d->stop )
+			return;
+		Trace::Span span( "open" );
+		fds[i] = ::open( QFile::encodeName( files.at( i ).path ).constData(), O_RDONLY | O_CLOEXEC );
+#ifdef POSIX_FADV_WILLNEED
+		if( fds[i] >= 0 )
+			::posix_fadvise( fds[i], 0, 0, POSIX_FADV_WILLNEED );
+#endif
+	};
+	for( int i = 0; i < READAHEAD_FILES; i++ )
+		prefetch( i );
+#endif
+
+	quint64 bytes = 0;
+	for( int i = 0; i < files.size(); i++ ) {
+		HashResult result;
+		result.path = files.at( i ).path;
+		result.size = files.at( i ).size;
+		// Charged up front, a file that grew and is streamed only adds
+		// the bytes beyond its listed size.
+		d->throttle.acquire( quint64( result.size ), &d->stop );
+		monitor.reset( quint64( result.size ) );
+
+#ifdef Q_OS_UNIX
+		prefetch( i + READAHEAD_FILES );
+		if( fds[i] >= 0 ) {
+			if( !d->stop )
+				result.digest = readAndHash( fds[i], result.size, buf, d->algorithm, &monitor );
+			::close( fds[i] );
+		}
+#else
+		QFile file( result.path );
+		if( !d->stop && file.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) ) {
+			const qint64 nread = file.read( buf.data(), buf.size() );
+			if( nread >= 0 && nread < buf.size() )
+				result.digest = d->algorithm->hashBuffer( buf.constData(), nread );
+			else if( nread >= 0 && file.seek( 0 ) )
+				result.digest = d->algorithm->hash( &file, &monitor );
+		}
+#endif
+		bytes += result.size;
+		results.append( result );
+	}
+
+	if( d->stop )
+		return;
+
+	d->doneBytes += bytes;
+	span.setArg( qint64( bytes ) );
+	Trace::Span publish( "publish" );
+	QMutexLocker locker( &d->pendingMutex );
+	d->pending += results;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <QtCore/QThread>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+#include "resultstore.h"
+#include "hashalgorithm.h"
+#include "filewalker.h"
+#include "throttle.h"
+
+/**
+ * Hashes all files below a set of paths on a pool of worker threads.
+ * Results are collected and delivered in batches, so receivers see a few
+ * signals per second instead of one per file.
+ */
+class BatchHasher : public QThread
+{
+	Q_OBJECT
+
+public:
+	BatchHasher( QObject *parent = nullptr );
+	~BatchHasher();
+
+	void setInput( const QStringList &paths );
+	bool setAlgorithm( const QString &name );
+	int digestSize() const;
+	void setMaxThreads( int count );
+	void setPriority( Throttle::Priority priority );
+	double bandwidthLimit() const;
+	double effectiveRate() const;
+
+protected:
+	void run();
+
+public slots:
+	void stopProcess();
+	// MB/s, 0 for no limit. May be changed while hashing.
+	void setBandwidthLimit( double mbps );
+
+private:
+	class Private;
+	Private *d;
+
+	void applyPriority();
+	void hashFile( const QString &path, qint64 size );
+	void hashSmallFiles( const QVector<FileEntry> &files );
+
+signals:
+	void progressChanged( float );
+	void resultsReady( QVector<HashResult> );
+	void throughputChanged( double mbps, double limit );
+};
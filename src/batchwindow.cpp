@@ -1,14 +1,175 @@
 #include "batchwindow.h"
 
+#include <QtCore/QLocale>
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QHBoxLayout>
+#include <QtWidgets/QLineEdit>
+#include <QtWidgets/QTableView>
+#include <QtWidgets/QHeaderView>
+#include <QtWidgets/QProgressBar>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QToolButton>
+#include <QtWidgets/QCheckBox>
+#include <QtWidgets/QSpinBox>
+
+#include "batchhasher.h"
+#include "resultmodel.h"
+
 class BatchWindow::Private {
 public:
 	Private()
 	{}
+
+	BatchHasher hasher;
+	ResultModel model;
+
+	QLineEdit *filterEdit = nullptr;
+	QTableView *view = nullptr;
+	QProgressBar *progressBar = nullptr;
+	QToolButton *cancelButton = nullptr;
+	QCheckBox *backgroundBox = nullptr;
+	QSpinBox *limitBox = nullptr;
+	QLabel *statusLabel = nullptr;
+	QLabel *throughputLabel = nullptr;
 };
 
-BatchWindow::BatchWindow( QObject *parent )
-	: QObject( parent ), d( new BatchWindow::Private() )
-{}
+BatchWindow::BatchWindow( QWidget *parent )
+	: QWidget( parent, Qt::Window ), d( new BatchWindow::Private() )
+{
+	setWindowTitle( tr( "insaneSums - Batch" ) );
+	setWindowIcon( QIcon( ":/images/logo.png" ) );
+	resize( 900, 600 );
+
+	d->filterEdit = new QLineEdit( this );
+	d->filterEdit->setPlaceholderText( tr( "Filter by path" ) );
+	d->filterEdit->setClearButtonEnabled( true );
+
+	// Fixed row heights let the view scroll without measuring any rows.
+	d->view = new QTableView( this );
+	d->view->setModel( &d->model );
+	d->view->setSortingEnabled( true );
+	d->view->sortByColumn( -1, Qt::AscendingOrder );
+	d->view->setSelectionBehavior( QAbstractItemView::SelectRows );
+	d->view->setWordWrap( false );
+	d->view->verticalHeader()->setSectionResizeMode( QHeaderView::Fixed );
+	d->view->verticalHeader()->setDefaultSectionSize( d->view->fontMetrics().height() + 4 );
+	d->view->verticalHeader()->hide();
+	d->view->horizontalHeader()->setSectionResizeMode( QHeaderView::Interactive );
+	d->view->horizontalHeader()->setStretchLastSection( true );
+	d->view->setColumnWidth( ResultModel::NameColumn, 200 );
+	d->view->setColumnWidth( ResultModel::DirectoryColumn, 300 );
+
+	d->progressBar = new QProgressBar( this );
+	d->progressBar->setMaximum( 1000 );
+	d->progressBar->setFormat( "%p%" );
+	d->cancelButton = new QToolButton( this );
+	d->cancelButton->setIcon( QIcon( ":/images/button_cancel.png" ) );
+	d->cancelButton->setAutoRaise( true );
+	d->statusLabel = new QLabel( this );
+	d->throughputLabel = new QLabel( this );
+
+	// Background mode and bandwidth limit apply while hashing is running.
+	d->backgroundBox = new QCheckBox( tr( "Background" ), this );
+	d->backgroundBox->setToolTip( tr( "Lowest CPU and I/O priority for the workers." ) );
+	d->limitBox = new QSpinBox( this );
+	d->limitBox->setRange( 0, 100000 );
+	d->limitBox->setSuffix( tr( " MB/s" ) );
+	d->limitBox->setSpecialValueText( tr( "No limit" ) );
+	d->limitBox->setToolTip( tr( "Bandwidth limit of all workers together." ) );
+
+	QHBoxLayout *progressLayout = new QHBoxLayout();
+	progressLayout->addWidget( d->progressBar );
+	progressLayout->addWidget( d->cancelButton );
+	progressLayout->addWidget( d->backgroundBox );
+	progressLayout->addWidget( d->limitBox );
+
+	QHBoxLayout *statusLayout = new QHBoxLayout();
+	statusLayout->addWidget( d->statusLabel, 1 );
+	statusLayout->addWidget( d->throughputLabel );
+
+	QVBoxLayout *layout = new QVBoxLayout( this );
+	layout->addWidget( d->filterEdit );
+	layout->addWidget( d->view );
+	layout->addLayout( progressLayout );
+	layout->addLayout( statusLayout );
+
+	connect( d->filterEdit, SIGNAL( textChanged( const QString & ) ),
+			 &d->model, SLOT( setFilter( const QString & ) ) );
+	connect( d->cancelButton, SIGNAL( clicked() ), this, SLOT( stopProcess() ) );
+	connect( &d->hasher, SIGNAL( progressChanged( float ) ),
+			 this, SLOT( updateProgress( const float ) ) );
+	connect( &d->hasher, SIGNAL( resultsReady( QVector<HashResult> ) ),
+			 &d->model, SLOT( appendResults( const QVector<HashResult> & ) ) );
+	connect( &d->hasher, SIGNAL( finished() ), this, SLOT( hashingFinished() ) );
+	connect( &d->hasher, SIGNAL( throughputChanged( double, double ) ),
+			 this, SLOT( updateThroughput( double, double ) ) );
+	connect( d->backgroundBox, &QCheckBox::toggled, this, [this]( bool checked ) {
+		d->hasher.setPriority( checked ? Throttle::BackgroundPriority : Throttle::NormalPriority );
+	} );
+	connect( d->limitBox, QOverload<int>::of( &QSpinBox::valueChanged ), this, [this]( int mbps ) {
+		d->hasher.setBandwidthLimit( mbps );
+	} );
+	connect( &d->model, SIGNAL( rowsInserted( const QModelIndex &, int, int ) ),
+			 this, SLOT( updateStatus() ) );
+	connect( &d->model, SIGNAL( modelReset() ), this, SLOT( updateStatus() ) );
+	connect( &d->model, &ResultModel::busyChanged, this, [this]( bool busy ) {
+		d->filterEdit->setStyleSheet( busy ? "color: gray" : QString() );
+	} );
+}
 
 BatchWindow::~BatchWindow()
-{}
+{
+	d->hasher.stopProcess();
+	d->hasher.wait();
+	delete d;
+}
+
+bool BatchWindow::start( const QStringList &paths, const QString &algorithm )
+{
+	if( d->hasher.isRunning() || !d->hasher.setAlgorithm( algorithm ) )
+		return false;
+
+	setWindowTitle( tr( "insaneSums - %1" ).arg( algorithm.toUpper() ) );
+	d->model.clear();
+	d->model.setDigestSize( d->hasher.digestSize() );
+	d->hasher.setInput( paths );
+	d->cancelButton->setEnabled( true );
+	d->hasher.start();
+	return true;
+}
+
+void BatchWindow::stopProcess()
+{
+	d->hasher.stopProcess();
+}
+
+void BatchWindow::updateProgress( const float c )
+{
+	d->progressBar->setValue( c * d->progressBar->maximum() );
+}
+
+void BatchWindow::updateStatus()
+{
+	const ResultStore &store = d->model.store();
+	const quint32 rows = store.count();
+	const quint64 bytes = store.memoryUsage();
+	d->statusLabel->setText( tr( "%1 of %2 files shown, %3 per row" )
+			.arg( d->model.rowCount() )
+			.arg( rows )
+			.arg( QLocale().formattedDataSize( rows ? bytes / rows : 0 ) ) );
+}
+
+void BatchWindow::updateThroughput( double mbps, double limit )
+{
+	if( limit > 0 )
+		d->throughputLabel->setText( tr( "%1 MB/s (limited to %2 MB/s)" )
+				.arg( mbps, 0, 'f', 1 ).arg( limit, 0, 'f', 0 ) );
+	else
+		d->throughputLabel->setText( tr( "%1 MB/s" ).arg( mbps, 0, 'f', 1 ) );
+}
+
+void BatchWindow::hashingFinished()
+{
+	d->cancelButton->setEnabled( false );
+	updateStatus();
+}
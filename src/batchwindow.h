@@ -1,14 +1,28 @@
 #pragma once
-#include "QtCore/QObject"
+#include <QtWidgets/QWidget>
 
-class BatchWindow : public QObject
+/**
+ * Window listing the results of hashing a whole directory tree.
+ */
+class BatchWindow : public QWidget
 {
 	Q_OBJECT
 
 public:
-	BatchWindow( QObject *parent = nullptr );
+	BatchWindow( QWidget *parent = nullptr );
 	~BatchWindow();
 
+	bool start( const QStringList &paths, const QString &algorithm );
+
+public slots:
+	void stopProcess();
+
+private slots:
+	void updateProgress( const float );
+	void updateStatus();
+	void updateThroughput( double mbps, double limit );
+	void hashingFinished();
+
 private:
 	class Private;
 	Private *d;
@@ -0,0 +1,328 @@
+#include "chunker.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDirIterator>
+#include <QtCore/QThreadPool>
+#include <QtCore/QMutexLocker>
+
+#include <cryptopp/sha.h>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#define READ_SIZE (4 * 1024 * 1024)
+
+namespace {
+
+// Gear table of the rolling hash, filled with splitmix64 output at compile
+// time so the chunk boundaries never depend on the platform.
+constexpr std::array<quint64, 256> makeGearTable()
+{
+	std::array<quint64, 256> table {};
+	quint64 state = 0x696e73616e6553ULL; // "insaneS"
+	for( std::size_t i = 0; i < table.size(); i++ ) {
+		state += 0x9e3779b97f4a7c15ULL;
+		quint64 z = state;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		table[i] = z ^ (z >> 31);
+	}
+	return table;
+}
+
+constexpr std::array<quint64, 256> GEAR = makeGearTable();
+
+int log2Floor( quint32 v )
+{
+	int bits = 0;
+	while( v >>= 1 )
+		bits++;
+	return bits;
+}
+
+// Mask with the given number of ones in the most significant bits.
+quint64 topMask( int bits )
+{
+	return bits <= 0 ? 0 : ~0ULL << (64 - bits);
+}
+
+} // namespace
+
+bool ChunkerParams::isValid() const
+{
+	if( avgSize < 64 || (avgSize & (avgSize - 1)) != 0 )
+		return false;
+	return minSize > 0 && minSize < avgSize && avgSize < maxSize;
+}
+
+GearChunker::GearChunker( const ChunkerParams &params )
+	: p( params )
+{
+	const int bits = log2Floor( p.avgSize );
+	maskS = topMask( bits + 2 );
+	maskL = topMask( bits - 2 );
+}
+
+std::size_t GearChunker::cut( const uchar *data, std::size_t len ) const
+{
+	if( len <= p.minSize )
+		return len;
+
+	std::size_t end = len < p.maxSize ? len : p.maxSize;
+	std::size_t normal = end < p.avgSize ? end : p.avgSize;
+
+	// Bytes below the minimum size can never be a boundary, so skip them.
+	quint64 fp = 0;
+	std::size_t i = p.minSize;
+	for( ; i < normal; i++ ) {
+		fp = (fp << 1) + GEAR[data[i]];
+		if( !(fp & maskS) )
+			return i + 1;
+	}
+	for( ; i < end; i++ ) {
+		fp = (fp << 1) + GEAR[data[i]];
+		if( !(fp & maskL) )
+			return i + 1;
+	}
+	return end;
+}
+
+ChunkIndex::ChunkIndex()
+{
+}
+
+bool ChunkIndex::insert( const ChunkKey &key )
+{
+	Shard &shard = shards[key.hi % SHARD_COUNT];
+	QMutexLocker locker( &shard.mutex );
+	const qsizetype before = shard.chunks.size();
+	shard.chunks.insert( key );
+	return shard.chunks.size() != before;
+}
+
+quint64 ChunkIndex::uniqueChunks() const
+{
+	quint64 count = 0;
+	for( Shard &shard : shards ) {
+		QMutexLocker locker( &shard.mutex );
+		count += shard.chunks.size();
+	}
+	return count;
+}
+
+void ChunkIndex::clear()
+{
+	for( Shard &shard : shards ) {
+		QMutexLocker locker( &shard.mutex );
+		shard.chunks.clear();
+	}
+}
+
+class CIChunkAnalysis::Private {
+public:
+	Private( const ChunkerParams &params )
+		: chunker( params ), maxThreads( QThread::idealThreadCount() )
+	{}
+
+	GearChunker chunker;
+	ChunkIndex index;
+	QStringList inputs;
+	int maxThreads;
+	quint64 inputBytes = 0;
+
+	Throttle throttle;
+	std::atomic<int> priority { Throttle::NormalPriority };
+
+	std::atomic<bool> stop { false };
+	std::atomic<quint64> files { 0 };
+	std::atomic<quint64> failedFiles { 0 };
+	std::atomic<quint64> totalBytes { 0 };
+	std::atomic<quint64> uniqueBytes { 0 };
+	std::atomic<quint64> totalChunks { 0 };
+	std::atomic<quint64> uniqueChunks { 0 };
+
+	void reset()
+	{
+		index.clear();
+		inputBytes = 0;
+		stop = false;
+		files = 0;
+		failedFiles = 0;
+		totalBytes = 0;
+		uniqueBytes = 0;
+		totalChunks = 0;
+		uniqueChunks = 0;
+	}
+};
+
+CIChunkAnalysis::CIChunkAnalysis( QObject *parent, const ChunkerParams &params )
+	: QThread( parent ), d( new CIChunkAnalysis::Private( params ) )
+{
+	qRegisterMetaType<DedupStats>();
+}
+
+CIChunkAnalysis::~CIChunkAnalysis()
+{
+	stopProcess();
+	wait();
+	delete d;
+}
+
+void CIChunkAnalysis::setInput( const QStringList &paths )
+{
+	d->inputs = paths;
+}
+
+void CIChunkAnalysis::setMaxThreads( int count )
+{
+	d->maxThreads = count > 0 ? count : QThread::idealThreadCount();
+}
+
+void CIChunkAnalysis::setPriority( Throttle::Priority priority )
+{
+	d->priority = priority;
+}
+
+void CIChunkAnalysis::setBandwidthLimit( double mbps )
+{
+	d->throttle.setLimit( mbps );
+}
+
+DedupStats CIChunkAnalysis::result() const
+{
+	DedupStats stats;
+	stats.files = d->files;
+	stats.failedFiles = d->failedFiles;
+	stats.totalBytes = d->totalBytes;
+	stats.uniqueBytes = d->uniqueBytes;
+	stats.totalChunks = d->totalChunks;
+	stats.uniqueChunks = d->uniqueChunks;
+	return stats;
+}
+
+void CIChunkAnalysis::stopProcess()
+{
+	d->stop = true;
+}
+
+void CIChunkAnalysis::run()
+{
+	d->reset();
+
+	// Expand directories into the list of files to chunk.
+	QStringList files;
+	for( const QString &path : d->inputs ) {
+		QFileInfo info( path );
+		if( info.isFile() ) {
+			files << info.absoluteFilePath();
+			d->inputBytes += info.size();
+		} else if( info.isDir() ) {
+			QDirIterator it( path, QDir::Files | QDir::Hidden | QDir::NoSymLinks,
+							 QDirIterator::Subdirectories );
+			while( it.hasNext() ) {
+				it.next();
+				files << it.filePath();
+				d->inputBytes += it.fileInfo().size();
+			}
+		}
+	}
+
+	QThreadPool pool;
+	pool.setMaxThreadCount( d->maxThreads );
+	for( const QString &file : files )
+		pool.start( [this, file]() { chunkFile( file ); } );
+
+	// Report progress while the workers are busy.
+	while( !pool.waitForDone( 100 ) ) {
+		if( d->inputBytes )
+			emit progressChanged( (float)d->totalBytes / d->inputBytes );
+	}
+
+	if( !d->stop ) {
+		emit progressChanged( 1.0f );
+		emit analysisDone( result() );
+	} else {
+		emit progressChanged( 0.0f );
+	}
+}
+
+void CIChunkAnalysis::chunkFile( const QString &path )
+{
+	if( d->stop )
+		return;
+
+	Throttle::setCurrentThreadPriority( Throttle::Priority( d->priority.load() ) );
+	QFile file( path );
+	if( !file.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) ) {
+		d->failedFiles++;
+		return;
+	}
+
+	const std::size_t maxSize = d->chunker.params().maxSize;
+	const std::size_t bufSize = qMax<std::size_t>( READ_SIZE, 4 * maxSize );
+	std::vector<uchar> buf( bufSize );
+	std::size_t start = 0;
+	std::size_t end = 0;
+	bool eof = false;
+
+	CryptoPP::SHA256 sha;
+	CryptoPP::byte digest[CryptoPP::SHA256::DIGESTSIZE];
+
+	// Counters are kept locally and published once per buffer, so the
+	// workers don't fight over the shared atomics for every chunk.
+	quint64 bytes = 0, chunks = 0, newBytes = 0, newChunks = 0;
+	auto publish = [&]() {
+		d->totalBytes += bytes;
+		d->totalChunks += chunks;
+		d->uniqueBytes += newBytes;
+		d->uniqueChunks += newChunks;
+		bytes = chunks = newBytes = newChunks = 0;
+	};
+
+	while( !d->stop ) {
+		// Keep at least one chunk of maximum size buffered, the chunker
+		// treats a shorter buffer as the end of the input.
+		if( !eof && end - start < maxSize ) {
+			publish();
+			std::memmove( buf.data(), buf.data() + start, end - start );
+			end -= start;
+			start = 0;
+			while( !eof && end < bufSize ) {
+				qint64 nread = file.read( (char*)buf.data() + end, bufSize - end );
+				if( nread < 0 ) {
+					// Chunks already in the index stay counted, later
+					// duplicates of them must not look free.
+					publish();
+					d->failedFiles++;
+					return;
+				}
+				if( nread == 0 )
+					eof = true;
+				end += nread;
+				d->throttle.acquire( quint64( nread ), &d->stop );
+			}
+		}
+		if( start == end )
+			break;
+
+		const std::size_t len = d->chunker.cut( buf.data() + start, end - start );
+		sha.CalculateDigest( digest, buf.data() + start, len );
+
+		ChunkKey key;
+		std::memcpy( &key.hi, digest, sizeof( key.hi ) );
+		std::memcpy( &key.lo, digest + sizeof( key.hi ), sizeof( key.lo ) );
+		if( d->index.insert( key ) ) {
+			newChunks++;
+			newBytes += len;
+		}
+		chunks++;
+		bytes += len;
+		start += len;
+	}
+	publish();
+
+	if( !d->stop )
+		d->files++;
+}
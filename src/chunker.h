@@ -0,0 +1,139 @@
+#pragma once
+#include <QtCore/QThread>
+#include <QtCore/QStringList>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QMetaType>
+
+#include <atomic>
+#include <cstddef>
+
+#include "throttle.h"
+
+/**
+ * Size limits of the content-defined chunker. The average size must be a
+ * power of two, sizes are in bytes.
+ */
+struct ChunkerParams
+{
+	quint32 minSize = 2 * 1024;
+	quint32 avgSize = 8 * 1024;
+	quint32 maxSize = 64 * 1024;
+
+	bool isValid() const;
+};
+
+/**
+ * FastCDC-style gear-hash chunker with normalized chunking.
+ * Stateless apart from its parameters, so one instance may be shared
+ * between threads.
+ */
+class GearChunker
+{
+public:
+	explicit GearChunker( const ChunkerParams &params );
+
+	// Returns the length of the chunk that starts at data. If len is
+	// smaller than the maximum chunk size, the caller has to make sure
+	// that data ends at the end of the input.
+	std::size_t cut( const uchar *data, std::size_t len ) const;
+
+	const ChunkerParams & params() const { return p; }
+
+private:
+	ChunkerParams p;
+	quint64 maskS; // stricter mask, used below the average size
+	quint64 maskL; // looser mask, used above the average size
+};
+
+/**
+ * Truncated 128 bit chunk digest, used as key in the chunk index.
+ */
+struct ChunkKey
+{
+	quint64 hi;
+	quint64 lo;
+
+	bool operator==( const ChunkKey &o ) const { return hi == o.hi && lo == o.lo; }
+};
+
+inline size_t qHash( const ChunkKey &key, size_t seed = 0 )
+{
+	return static_cast<size_t>( key.lo ) ^ seed;
+}
+
+/**
+ * Concurrent set of chunk digests. Split into independently locked shards,
+ * so workers rarely contend for the same mutex.
+ */
+class ChunkIndex
+{
+public:
+	ChunkIndex();
+
+	// Returns true if the chunk was not seen before.
+	bool insert( const ChunkKey &key );
+	quint64 uniqueChunks() const;
+	void clear();
+
+private:
+	static const int SHARD_COUNT = 64;
+
+	struct Shard {
+		QMutex mutex;
+		QSet<ChunkKey> chunks;
+	};
+	mutable Shard shards[SHARD_COUNT];
+};
+
+/**
+ * Summary of a deduplication analysis.
+ */
+struct DedupStats
+{
+	quint64 files = 0;
+	quint64 totalBytes = 0;
+	quint64 uniqueBytes = 0;
+	quint64 totalChunks = 0;
+	quint64 uniqueChunks = 0;
+	quint64 failedFiles = 0;
+
+	double ratio() const { return uniqueBytes ? (double)totalBytes / uniqueBytes : 1.0; }
+};
+Q_DECLARE_METATYPE( DedupStats )
+
+/**
+ * Chunks all files of a batch in parallel and aggregates how many bytes
+ * are unique across the whole batch. Directories are walked recursively.
+ */
+class CIChunkAnalysis : public QThread
+{
+	Q_OBJECT
+
+public:
+	CIChunkAnalysis( QObject *parent, const ChunkerParams &params );
+	~CIChunkAnalysis();
+
+	void setInput( const QStringList &paths );
+	void setMaxThreads( int count );
+	void setPriority( Throttle::Priority priority );
+	// MB/s, 0 for no limit.
+	void setBandwidthLimit( double mbps );
+	DedupStats result() const;
+
+protected:
+	void run();
+
+public slots:
+	void stopProcess();
+
+private:
+	class Private;
+	Private *d;
+
+	void chunkFile( const QString &path );
+
+signals:
+	void progressChanged( float );
+	void analysisDone( DedupStats );
+};
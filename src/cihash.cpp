@@ -3,55 +3,39 @@
 #include <QtCore/QObject>
 #include <QtCore/QIODevice>
 #include <QtCore/QByteArray>
-#include <QtCore/QDataStream>
 #include <QtCore/QMutexLocker>
 
-#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
+#include "trace.h"
 
-#include <cryptopp/sha.h>
-//#include <cryptopp/tiger.h>
-//#include <cryptopp/whrlpool.h>
-//#include <cryptopp/ripemd.h>
-#include <cryptopp/crc.h>
-#include <cryptopp/md5.h>
+#define PROGRESS_STEPS 1000
 
-#define MAX_READ_SIZE 1024
-
-CIHash::CIHash( QObject *parent, CryptoPP::HashTransformation *ht )
-	: QThread( parent ), hash( ht ), bStop( false )
+CIHash::CIHash( QObject *parent, const HashAlgorithm *algo, IOBackend backend )
+	: QThread( parent ), algo( algo ), backend( backend ), input( NULL ),
+	  bStop( false ), size( 0 ), lastProgress( 0 ), throttle( NULL ),
+	  priority( Throttle::NormalPriority ), lastDone( 0 )
 {
-	if( !hash )
-		hash = new CryptoPP::SHA1();
+	if( !this->algo )
+		this->algo = HashAlgorithm::find( "sha1" );
 }
 
 CIHash::~CIHash()
 {
-	if( hash )
-		delete hash;
 	if( input )
 		delete input;
 }
 
-QByteArray CIHash::digestToBytes()
+void CIHash::setInput( QIODevice *dev )
 {
-	if( !hash )
-		return *(new QByteArray());
-
-	// Get the result.
-	char *result = (char*)malloc( hash->DigestSize() );
-	hash->Final( (CryptoPP::byte*)result );
-
-	// Convert to hex string and return.
-	QByteArray bytes( result, hash->DigestSize() );
-	delete result;
-
-	return bytes;
+	mutex.lock();
+	input = dev;
+	mutex.unlock();
 }
 
-void CIHash::setInput( QIODevice *dev )
+void CIHash::setThrottle( Throttle *t, Throttle::Priority p )
 {
 	mutex.lock();
-	input = dev;
+	throttle = t;
+	priority = p;
 	mutex.unlock();
 }
 
@@ -59,143 +43,83 @@ void CIHash::run()
 {
 	mutex.lock();
 	bStop = false;
+	Trace::setThreadName( "CIHash" );
+	if( priority != Throttle::NormalPriority )
+		Throttle::setCurrentThreadPriority( priority );
 	calculate();
 	mutex.unlock();
 }
 
 bool CIHash::calculate()
 {
-	if( !hash || !input )
+	if( !algo || !input )
 		return false;
 
-	// Open input device and initialize stream.
-	input->open( QIODevice::ReadOnly );
-	QDataStream stream( input );
+	// Open input device.
+	{
+		Trace::Span span( "open" );
+		if( !input->isOpen() && !input->open( QIODevice::ReadOnly ) )
+			return false;
+	}
 
 	// Get (file) size of the input.
-	qint64 size = input->size();
-	quint64 allread = 0;
-
-	// Create hash processor and read parameters.
-	unsigned int optlength = hash->OptimalBlockSize();
-	unsigned int passes = MAX_READ_SIZE / optlength;
-	unsigned int nread = 0;
-	unsigned int pass = 0;
-	char *buf = (char*)malloc( optlength );
-	// Start reading the input.
-	while( !bStop && (nread = stream.readRawData( buf, optlength )) > 0 ) {
-		hash->Update( (CryptoPP::byte*)buf, nread );
-		allread += nread;
-		pass++;
-		if( pass >= passes ) {
-			emit progressChanged( (float)allread / size );
-			pass = 0;
-		}
+	size = input->size();
+	lastProgress = 0;
+	lastDone = 0;
+
+	// The kernel reads and hashes the whole input.
+	{
+		Trace::Span span( "file", size );
+		bytes = algo->hash( input, this, backend );
 	}
-	if( !bStop ) {
+	if( !bStop && !bytes.isEmpty() ) {
 		// Be done.
 		emit progressChanged( 1.0f );
 
 		// Get result.
-		emit digest( digestToBytes() );
+		Trace::Span span( "deliver" );
+		emit digest( bytes );
 	} else {
 		emit progressChanged( 0.0f );
 	}
 
-	// Close file and release buffer.
-	delete buf;
-	buf = NULL;
+	// Close file.
 	input->close();
 
 	return true;
 }
 
-QByteArray CIHash::result()
-{
-	return digestToBytes();
-}
-
-void CIHash::stopProcess()
-{
-	bStop = true;
-}
-
-CIHash* CIHash::createMD5()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::Weak::MD5 );
-	return h;
-}
-
-CIHash* CIHash::createSHA1()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::SHA1 );
-	return h;
-}
-
-CIHash* CIHash::createSHA256()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::SHA256 );
-	return h;
-}
-
-CIHash* CIHash::createSHA224()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::SHA224 );
-	return h;
-}
-
-CIHash* CIHash::createSHA384()
+bool CIHash::update( quint64 done )
 {
-	CIHash *h = new CIHash( NULL, new CryptoPP::SHA384 );
-	return h;
-}
-
-CIHash* CIHash::createSHA512()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::SHA512 );
-	return h;
-}
-
-/*
-CIHash* CIHash::createTiger()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::Tiger );
-	return h;
-}
+	if( throttle )
+		throttle->acquire( done - lastDone, &bStop );
+	lastDone = done;
 
-CIHash* CIHash::createWhirlpool()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::Whirlpool );
-	return h;
-}
-
-CIHash* CIHash::createRIPEMD160()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::RIPEMD160 );
-	return h;
-}
-
-CIHash* CIHash::createRIPEMD320()
-{
-	CIHash *h = new CIHash( NULL, new CryptoPP::RIPEMD320 );
-	return h;
+	// Only signal visible changes of the progress.
+	if( size > 0 ) {
+		const int progress = int( done * PROGRESS_STEPS / quint64( size ) );
+		if( progress != lastProgress ) {
+			lastProgress = progress;
+			emit progressChanged( (float)done / size );
+		}
+	}
+	return !bStop;
 }
 
-CIHash* CIHash::createRIPEMD128()
+QByteArray CIHash::result()
 {
-	CIHash *h = new CIHash( NULL, new CryptoPP::RIPEMD128 );
-	return h;
+	return bytes;
 }
 
-CIHash* CIHash::createRIPEMD256()
+void CIHash::stopProcess()
 {
-	CIHash *h = new CIHash( NULL, new CryptoPP::RIPEMD256 );
-	return h;
+	bStop = true;
 }
 
-CIHash* CIHash::createCRC32()
+CIHash* CIHash::create( const QString &name )
 {
-	CIHash *h = new CIHash( NULL, new CryptoPP::CRC32 );
-	return h;
+	const HashAlgorithm *algo = HashAlgorithm::find( name );
+	if( !algo )
+		return NULL;
+	return new CIHash( NULL, algo );
 }
-*/
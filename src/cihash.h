@@ -4,34 +4,27 @@
 #include <QtCore/QByteArray>
 #include <QtCore/QMutex>
 
-#include <cryptopp/cryptlib.h>
+#include <atomic>
 
-class CIHash : public QThread
+#include "hashalgorithm.h"
+#include "throttle.h"
+
+class CIHash : public QThread, private HashMonitor
 {
 	Q_OBJECT
 
 public:
-	CIHash(QObject *parent, CryptoPP::HashTransformation *ht );
+	CIHash( QObject *parent, const HashAlgorithm *algo, IOBackend backend = IOBackend::Stream );
 	~CIHash();
 
 	void setInput( QIODevice* );
+	// Runs in background mode, the throttle may be shared and is not owned.
+	void setThrottle( Throttle *throttle, Throttle::Priority priority = Throttle::BackgroundPriority );
 	QByteArray result();
+	const HashAlgorithm * algorithm() const { return algo; }
 
-	static CIHash* createMD5(); // Manual copy from source. Not in DLL.
-	static CIHash* createSHA1();
-	static CIHash* createSHA256();
-	static CIHash* createSHA224();
-	static CIHash* createSHA384();
-	static CIHash* createSHA512();
-	/* Not in DLL
-	static CIHash* createTiger();
-	static CIHash* createWhirlpool();
-	static CIHash* createRIPEMD160();
-	static CIHash* createRIPEMD320();
-	static CIHash* createRIPEMD128();
-	static CIHash* createRIPEMD256();
-	static CIHash* createCRC32();
-	*/
+	// Returns nullptr for unknown algorithm names.
+	static CIHash* create( const QString &name );
 
 protected:
 	void run();
@@ -43,12 +36,19 @@ public slots:
 	void stopProcess();
 
 private:
-	CryptoPP::HashTransformation *hash;
+	const HashAlgorithm *algo;
+	IOBackend backend;
 	QIODevice *input;
 	QMutex mutex;
-	bool bStop;
-
-	QByteArray digestToBytes();
+	std::atomic<bool> bStop;
+	QByteArray bytes;
+	qint64 size;
+	int lastProgress;
+	Throttle *throttle;
+	Throttle::Priority priority;
+	quint64 lastDone;
+
+	bool update( quint64 done ) override;
 
 signals:
 	void progressChanged( float );
@@ -0,0 +1,597 @@
+#include "commandline.h"
+
+#include <QtCore/QTextStream>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtNetwork/QLocalSocket>
+
+#include <cstring>
+#include <limits>
+
+#include "chunker.h"
+#include "hashalgorithm.h"
+#include "batchhasher.h"
+#include "hashdaemon.h"
+#include "manifestdiff.h"
+#include "manifestwriter.h"
+#include "treedigest.h"
+
+namespace {
+
+const char *const MODES[] = { "--dedup", "--daemon", "--query", "--tree", "--manifest", "--diff" };
+
+#define CONNECT_TIMEOUT 30000
+
+QTextStream& out()
+{
+	static QTextStream stream( stdout );
+	return stream;
+}
+
+QTextStream& err()
+{
+	static QTextStream stream( stderr );
+	return stream;
+}
+
+// Parses a size argument like "8192", "8k", "1M" or "2g", rejects values
+// above max.
+bool parseSize( const QString &str, quint64 max, quint64 *size )
+{
+	QString s = str.trimmed().toLower();
+	quint64 factor = 1;
+	if( s.endsWith( 'k' ) ) {
+		factor = 1024;
+		s.chop( 1 );
+	} else if( s.endsWith( 'm' ) ) {
+		factor = 1024 * 1024;
+		s.chop( 1 );
+	} else if( s.endsWith( 'g' ) ) {
+		factor = 1024 * 1024 * 1024;
+		s.chop( 1 );
+	}
+	bool ok = false;
+	const quint64 value = s.toULongLong( &ok );
+	if( !ok || value > max / factor )
+		return false;
+	*size = value * factor;
+	return true;
+}
+
+bool parseSize( const QString &str, quint32 *size )
+{
+	quint64 value = 0;
+	if( !parseSize( str, std::numeric_limits<quint32>::max(), &value ) )
+		return false;
+	*size = quint32( value );
+	return true;
+}
+
+// Backslash escaping of coreutils, extended to tabs, which separate the
+// columns of --diff.
+bool needsEscape( const QString &path )
+{
+	for( QChar c : path ) {
+		if( c == '\\' || c == '\n' || c == '\r' || c == '\t' )
+			return true;
+	}
+	return false;
+}
+
+QString escapePath( const QString &path )
+{
+	QString out;
+	out.reserve( path.size() + 8 );
+	for( QChar c : path ) {
+		if( c == '\\' )
+			out += "\\\\";
+		else if( c == '\n' )
+			out += "\\n";
+		else if( c == '\r' )
+			out += "\\r";
+		else if( c == '\t' )
+			out += "\\t";
+		else
+			out += c;
+	}
+	return out;
+}
+
+// Options of every mode that reads files.
+struct BackgroundOptions
+{
+	Throttle::Priority priority = Throttle::NormalPriority;
+	double limit = 0;
+
+	static bool isOption( const QString &arg )
+	{
+		return arg == "--background" || arg == "--idle" || arg == "--limit";
+	}
+
+	bool parse( const QStringList &args, int &i )
+	{
+		bool ok = true;
+		const QString &arg = args.at( i );
+		if( arg == "--background" )
+			priority = Throttle::BackgroundPriority;
+		else if( arg == "--idle" )
+			priority = Throttle::IdlePriority;
+		else if( i + 1 < args.size() )
+			limit = args.at( ++i ).toDouble( &ok );
+		else
+			ok = false;
+		return ok;
+	}
+};
+
+} // namespace
+
+bool CommandLine::isHeadless( int argc, char *argv[] )
+{
+	for( int i = 1; i < argc; i++ ) {
+		for( const char *mode : MODES ) {
+			if( std::strcmp( argv[i], mode ) == 0 )
+				return true;
+		}
+	}
+	return false;
+}
+
+int CommandLine::exec( const QStringList &args )
+{
+	if( args.contains( "--dedup" ) )
+		return dedup( args );
+	if( args.contains( "--daemon" ) )
+		return daemon( args );
+	if( args.contains( "--query" ) )
+		return query( args );
+	if( args.contains( "--tree" ) )
+		return tree( args );
+	if( args.contains( "--manifest" ) )
+		return manifest( args );
+	if( args.contains( "--diff" ) )
+		return diff( args );
+
+	printUsage();
+	return 2;
+}
+
+void CommandLine::printUsage()
+{
+	err() << "Usage: " << QCoreApplication::applicationName() << " <mode> [options] <paths>\n"
+		  << "\n"
+		  << "  --dedup             Estimate sub-file deduplication with content-defined chunking.\n"
+		  << "      --cdc-min SIZE  Minimum chunk size (default 2k).\n"
+		  << "      --cdc-avg SIZE  Average chunk size, a power of two (default 8k).\n"
+		  << "      --cdc-max SIZE  Maximum chunk size (default 64k).\n"
+		  << "      --threads N     Number of worker threads.\n"
+		  << "\n"
+		  << "  --daemon            Serve hash requests of local clients until terminated.\n"
+		  << "      --socket NAME   Local socket name (default " << HashDaemon::defaultSocketName() << ").\n"
+		  << "      --threads N     Number of worker threads.\n"
+		  << "      --cache N       Number of cached digests (default 100000).\n"
+		  << "\n"
+		  << "  --query             Hash files through a running daemon.\n"
+		  << "      --socket NAME   Local socket name of the daemon.\n"
+		  << "      -a ALGORITHM    Hash algorithm (default sha256).\n"
+		  << "      --verify HEX    Compare the digest of every path against HEX.\n"
+		  << "      --timeout SECS  Give up if no answer arrives within SECS (default never).\n"
+		  << "\n"
+		  << "  --tree              Print one digest over each directory tree.\n"
+		  << "      -a ALGORITHM    Hash algorithm (default sha256).\n"
+		  << "      --threads N     Number of worker threads.\n"
+		  << "      --cache FILE    Reuse and update subtree digests stored in FILE.\n"
+		  << "\n"
+		  << "  --manifest          Write a checksum manifest of all files.\n"
+		  << "      -a ALGORITHM    Hash algorithm (default sha256).\n"
+		  << "      --format F      coreutils (default), bsd or jsonl.\n"
+		  << "      -o FILE         Output file (default standard output).\n"
+		  << "      --sort          Sort the lines by path.\n"
+		  << "      --threads N     Number of worker threads.\n"
+		  << "\n"
+		  << "  --diff BEFORE AFTER Compare two coreutils or BSD style manifests. Prints\n"
+		  << "                      A, D, M or R (moved) and the paths, tab separated.\n"
+		  << "                      Lines with escaped paths start with a backslash.\n"
+		  << "      --memory SIZE   Memory budget before spilling to disk (default 256M).\n"
+		  << "\n"
+		  << "  --dedup, --daemon, --tree and --manifest also accept:\n"
+		  << "      --background    Run workers with background CPU and I/O priority.\n"
+		  << "      --idle          Run workers with idle CPU and I/O priority.\n"
+		  << "      --limit MB/s    Limit the read bandwidth of all workers.\n";
+	err().flush();
+}
+
+int CommandLine::dedup( const QStringList &args )
+{
+	ChunkerParams params;
+	BackgroundOptions background;
+	QStringList paths;
+	int threads = 0;
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--dedup" ) {
+			continue;
+		} else if( arg == "--cdc-min" && i + 1 < args.size() ) {
+			ok = parseSize( args.at( ++i ), &params.minSize );
+		} else if( arg == "--cdc-avg" && i + 1 < args.size() ) {
+			ok = parseSize( args.at( ++i ), &params.avgSize );
+		} else if( arg == "--cdc-max" && i + 1 < args.size() ) {
+			ok = parseSize( args.at( ++i ), &params.maxSize );
+		} else if( arg == "--threads" && i + 1 < args.size() ) {
+			threads = args.at( ++i ).toInt( &ok );
+		} else if( BackgroundOptions::isOption( arg ) ) {
+			ok = background.parse( args, i );
+		} else if( arg.startsWith( "--" ) ) {
+			ok = false;
+		} else {
+			paths << arg;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+
+	if( !params.isValid() ) {
+		err() << "Invalid chunk sizes, expected min < avg < max with avg a power of two.\n";
+		return 2;
+	}
+	if( paths.isEmpty() ) {
+		printUsage();
+		return 2;
+	}
+
+	CIChunkAnalysis analysis( nullptr, params );
+	analysis.setInput( paths );
+	analysis.setMaxThreads( threads );
+	analysis.setPriority( background.priority );
+	analysis.setBandwidthLimit( background.limit );
+	analysis.start();
+	analysis.wait();
+
+	const DedupStats stats = analysis.result();
+	out() << "files:         " << stats.files << "\n"
+		  << "failed:        " << stats.failedFiles << "\n"
+		  << "chunks:        " << stats.totalChunks << "\n"
+		  << "unique chunks: " << stats.uniqueChunks << "\n"
+		  << "total bytes:   " << stats.totalBytes << "\n"
+		  << "unique bytes:  " << stats.uniqueBytes << "\n"
+		  << "dedup ratio:   " << QString::number( stats.ratio(), 'f', 3 ) << "\n";
+	out().flush();
+
+	return stats.failedFiles ? 1 : 0;
+}
+
+int CommandLine::daemon( const QStringList &args )
+{
+	HashDaemon daemon;
+	BackgroundOptions background;
+	QString name = HashDaemon::defaultSocketName();
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--daemon" ) {
+			continue;
+		} else if( arg == "--socket" && i + 1 < args.size() ) {
+			name = args.at( ++i );
+		} else if( arg == "--threads" && i + 1 < args.size() ) {
+			daemon.setMaxThreads( args.at( ++i ).toInt( &ok ) );
+		} else if( arg == "--cache" && i + 1 < args.size() ) {
+			daemon.setCacheSize( args.at( ++i ).toInt( &ok ) );
+		} else if( BackgroundOptions::isOption( arg ) ) {
+			ok = background.parse( args, i );
+		} else {
+			ok = false;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+
+	daemon.setPriority( background.priority );
+	daemon.setBandwidthLimit( background.limit );
+	if( !daemon.listen( name ) ) {
+		err() << "Cannot listen on " << name << ": " << daemon.errorString() << "\n";
+		return 1;
+	}
+	return QCoreApplication::exec();
+}
+
+int CommandLine::query( const QStringList &args )
+{
+	QString name = HashDaemon::defaultSocketName();
+	QString algorithm = HashAlgorithm::defaultAlgorithm()->name;
+	QByteArray expected;
+	int timeout = -1;
+	QStringList paths;
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--query" ) {
+			continue;
+		} else if( arg == "--socket" && i + 1 < args.size() ) {
+			name = args.at( ++i );
+		} else if( arg == "-a" && i + 1 < args.size() ) {
+			algorithm = args.at( ++i );
+			ok = HashAlgorithm::find( algorithm ) != nullptr;
+		} else if( arg == "--verify" && i + 1 < args.size() ) {
+			expected = QByteArray::fromHex( args.at( ++i ).toLatin1() );
+			ok = !expected.isEmpty();
+		} else if( arg == "--timeout" && i + 1 < args.size() ) {
+			const int seconds = args.at( ++i ).toInt( &ok );
+			ok = ok && seconds > 0 && seconds <= std::numeric_limits<int>::max() / 1000;
+			timeout = seconds * 1000;
+		} else if( arg.startsWith( "--" ) ) {
+			ok = false;
+		} else {
+			paths << arg;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+	if( paths.isEmpty() ) {
+		printUsage();
+		return 2;
+	}
+
+	QLocalSocket socket;
+	socket.connectToServer( name );
+	if( !socket.waitForConnected( CONNECT_TIMEOUT ) ) {
+		err() << "Cannot connect to " << name << ": " << socket.errorString() << "\n";
+		return 1;
+	}
+
+	// Send everything up front, the daemon answers as files complete.
+	for( int i = 0; i < paths.size(); i++ ) {
+		HashDaemon::Request request;
+		request.type = expected.isEmpty() ? HashDaemon::HashRequest : HashDaemon::VerifyRequest;
+		request.id = quint32( i );
+		request.algorithm = algorithm;
+		request.path = QFileInfo( paths.at( i ) ).absoluteFilePath();
+		request.expected = expected;
+		socket.write( HashDaemon::encode( request ) );
+	}
+
+	int pending = paths.size();
+	int failed = 0;
+	QByteArray buffer;
+	while( pending > 0 ) {
+		// Hashing a large file can take arbitrarily long, so by default
+		// only a lost connection ends the wait.
+		if( !socket.bytesAvailable() && !socket.waitForReadyRead( timeout ) ) {
+			if( socket.error() == QLocalSocket::SocketTimeoutError )
+				err() << "No answer from " << name << " within " << timeout / 1000 << " seconds\n";
+			else
+				err() << "Connection lost: " << socket.errorString() << "\n";
+			return 1;
+		}
+		buffer += socket.readAll();
+
+		HashDaemon::Response response;
+		while( HashDaemon::decode( buffer, &response ) ) {
+			pending--;
+			const QString path = paths.value( int( response.id ) );
+			if( response.status == HashDaemon::Ok && expected.isEmpty() ) {
+				out() << response.digest.toHex() << "  " << path << "\n";
+			} else if( response.status == HashDaemon::Ok ) {
+				out() << path << ": OK\n";
+			} else if( response.status == HashDaemon::Mismatch ) {
+				out() << path << ": FAILED\n";
+				failed++;
+			} else {
+				err() << path << ": " << (response.status == HashDaemon::ReadError ? "read error" : "bad request") << "\n";
+				failed++;
+			}
+		}
+	}
+	out().flush();
+
+	return failed ? 1 : 0;
+}
+
+int CommandLine::tree( const QStringList &args )
+{
+	const HashAlgorithm *algorithm = HashAlgorithm::defaultAlgorithm();
+	BackgroundOptions background;
+	QString cacheFile;
+	QStringList paths;
+	int threads = 0;
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--tree" ) {
+			continue;
+		} else if( arg == "-a" && i + 1 < args.size() ) {
+			algorithm = HashAlgorithm::find( args.at( ++i ) );
+			ok = algorithm != nullptr;
+		} else if( arg == "--threads" && i + 1 < args.size() ) {
+			threads = args.at( ++i ).toInt( &ok );
+		} else if( arg == "--cache" && i + 1 < args.size() ) {
+			cacheFile = args.at( ++i );
+		} else if( BackgroundOptions::isOption( arg ) ) {
+			ok = background.parse( args, i );
+		} else if( arg.startsWith( "--" ) ) {
+			ok = false;
+		} else {
+			paths << arg;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+	if( paths.isEmpty() ) {
+		printUsage();
+		return 2;
+	}
+
+	// One cache serves all trees, it is keyed by absolute path.
+	TreeDigest digest( nullptr, algorithm );
+	digest.setMaxThreads( threads );
+	digest.setPriority( background.priority );
+	digest.setBandwidthLimit( background.limit );
+	if( !cacheFile.isEmpty() )
+		digest.loadCache( cacheFile );
+
+	int failed = 0;
+	for( const QString &path : paths ) {
+		digest.setInput( path );
+		digest.start();
+		digest.wait();
+
+		if( digest.result().isEmpty() ) {
+			err() << path << ": " << digest.failedEntries() << " entries could not be read\n";
+			failed++;
+			continue;
+		}
+		out() << digest.result().toHex() << "  " << path << "\n";
+		out().flush();
+		if( !cacheFile.isEmpty() && !digest.saveCache( cacheFile ) )
+			err() << "Cannot write " << cacheFile << "\n";
+	}
+
+	return failed ? 1 : 0;
+}
+
+int CommandLine::manifest( const QStringList &args )
+{
+	const HashAlgorithm *algorithm = HashAlgorithm::defaultAlgorithm();
+	ManifestWriter::Format format = ManifestWriter::CoreutilsFormat;
+	BackgroundOptions background;
+	QString output = "-";
+	QStringList paths;
+	bool sorted = false;
+	int threads = 0;
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--manifest" ) {
+			continue;
+		} else if( arg == "-a" && i + 1 < args.size() ) {
+			algorithm = HashAlgorithm::find( args.at( ++i ) );
+			ok = algorithm != nullptr;
+		} else if( arg == "--format" && i + 1 < args.size() ) {
+			ok = ManifestWriter::parseFormat( args.at( ++i ), &format );
+		} else if( arg == "-o" && i + 1 < args.size() ) {
+			output = args.at( ++i );
+		} else if( arg == "--sort" ) {
+			sorted = true;
+		} else if( arg == "--threads" && i + 1 < args.size() ) {
+			threads = args.at( ++i ).toInt( &ok );
+		} else if( BackgroundOptions::isOption( arg ) ) {
+			ok = background.parse( args, i );
+		} else if( arg.startsWith( "--" ) ) {
+			ok = false;
+		} else {
+			paths << arg;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+	if( paths.isEmpty() ) {
+		printUsage();
+		return 2;
+	}
+
+	ManifestWriter writer( algorithm, format );
+	writer.setSorted( sorted );
+	writer.setBaseDirectory( QDir::current() );
+	if( !writer.open( output ) ) {
+		err() << "Cannot open " << output << ": " << writer.errorString() << "\n";
+		return 1;
+	}
+
+	// Batches are written on the hasher thread as they arrive.
+	BatchHasher hasher;
+	hasher.setAlgorithm( algorithm->name );
+	hasher.setInput( paths );
+	hasher.setMaxThreads( threads );
+	hasher.setPriority( background.priority );
+	hasher.setBandwidthLimit( background.limit );
+	QObject::connect( &hasher, &BatchHasher::resultsReady, [&]( const QVector<HashResult> &batch ) {
+		if( !writer.write( batch ) )
+			hasher.stopProcess();
+	} );
+	hasher.start();
+	hasher.wait();
+
+	if( !writer.close() ) {
+		err() << "Cannot write " << output << ": " << writer.errorString() << "\n";
+		return 1;
+	}
+	if( writer.failedCount() )
+		err() << writer.failedCount() << " files could not be read\n";
+	return writer.failedCount() ? 1 : 0;
+}
+
+int CommandLine::diff( const QStringList &args )
+{
+	ManifestDiff diff;
+	QStringList manifests;
+
+	for( int i = 1; i < args.size(); i++ ) {
+		const QString &arg = args.at( i );
+		bool ok = true;
+		if( arg == "--diff" ) {
+			continue;
+		} else if( arg == "--memory" && i + 1 < args.size() ) {
+			quint64 memory = 0;
+			ok = parseSize( args.at( ++i ), std::numeric_limits<qint64>::max(), &memory ) && memory > 0;
+			diff.setMemoryBudget( qint64( memory ) );
+		} else if( arg.startsWith( "--" ) ) {
+			ok = false;
+		} else {
+			manifests << arg;
+		}
+		if( !ok ) {
+			err() << "Invalid argument: " << arg << "\n";
+			printUsage();
+			return 2;
+		}
+	}
+	if( manifests.size() != 2 ) {
+		printUsage();
+		return 2;
+	}
+
+	static const char *const CODES[] = { "A", "D", "M", "R" };
+	const bool ok = diff.run( manifests.at( 0 ), manifests.at( 1 ),
+			[]( ManifestDiff::Change change, const QString &path, const QString &oldPath ) {
+		// Like sha256sum, a leading backslash marks a line with escaped paths.
+		const bool escape = needsEscape( path ) || needsEscape( oldPath );
+		if( escape )
+			out() << '\\';
+		out() << CODES[change] << '\t';
+		if( change == ManifestDiff::Moved )
+			out() << (escape ? escapePath( oldPath ) : oldPath) << '\t';
+		out() << (escape ? escapePath( path ) : path) << '\n';
+	} );
+	out().flush();
+	if( !ok ) {
+		err() << diff.errorString() << "\n";
+		return 2;
+	}
+
+	// Like diff(1), 1 means the manifests differ.
+	const ManifestDiff::Stats stats = diff.stats();
+	err() << "unchanged " << stats.unchanged << ", added " << stats.added << ", removed " << stats.removed
+		  << ", modified " << stats.modified << ", moved " << stats.moved << "\n";
+	return stats.added || stats.removed || stats.modified || stats.moved ? 1 : 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <QtCore/QStringList>
+
+/**
+ * Headless batch modes, run without creating any window.
+ */
+class CommandLine
+{
+public:
+	// Returns true if the arguments select one of the headless modes.
+	static bool isHeadless( int argc, char *argv[] );
+	static int exec( const QStringList &args );
+
+private:
+	static int dedup( const QStringList &args );
+	static int daemon( const QStringList &args );
+	static int query( const QStringList &args );
+	static int tree( const QStringList &args );
+	static int manifest( const QStringList &args );
+	static int diff( const QStringList &args );
+	static void printUsage();
+};
@@ -0,0 +1,116 @@
+#include "filewalker.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDirIterator>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#endif
+
+bool FileWalker::walk( const QStringList &paths, const Callback &callback )
+{
+	for( const QString &path : paths ) {
+		QFileInfo info( path );
+		if( info.isFile() ) {
+			FileEntry entry;
+			entry.path = info.absoluteFilePath();
+			entry.size = info.size();
+			if( !callback( entry ) )
+				return false;
+		} else if( info.isDir() ) {
+			if( !walkDirectory( info.absoluteFilePath(), callback ) )
+				return false;
+		}
+	}
+	return true;
+}
+
+#ifdef Q_OS_UNIX
+
+bool FileWalker::walkDirectory( const QString &root, const Callback &callback )
+{
+	struct Name {
+		ino_t inode;
+		unsigned char type;
+		QByteArray name;
+	};
+
+	QVector<QByteArray> pending;
+	pending.append( QFile::encodeName( root ) );
+	QVector<Name> names;
+
+	while( !pending.isEmpty() ) {
+		const QByteArray dirPath = pending.takeLast();
+		DIR *dir = opendir( dirPath.constData() );
+		if( !dir )
+			continue;
+
+		// Read the whole directory before touching any inode.
+		names.clear();
+		while( struct dirent *ent = readdir( dir ) ) {
+			if( ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+					(ent->d_name[1] == '.' && ent->d_name[2] == '\0')) )
+				continue;
+			names.append( Name { ent->d_ino, ent->d_type, QByteArray( ent->d_name ) } );
+		}
+		std::sort( names.begin(), names.end(), []( const Name &a, const Name &b ) {
+			return a.inode < b.inode;
+		} );
+
+		const int fd = dirfd( dir );
+		const QByteArray dirPrefix = dirPath.endsWith( '/' ) ? dirPath : dirPath + '/';
+		const QString prefix = QFile::decodeName( dirPrefix );
+		for( const Name &name : qAsConst( names ) ) {
+			if( name.type == DT_DIR ) {
+				pending.append( dirPrefix + name.name );
+				continue;
+			}
+			if( name.type != DT_REG && name.type != DT_UNKNOWN )
+				continue;
+
+			struct stat st;
+			if( fstatat( fd, name.name.constData(), &st, AT_SYMLINK_NOFOLLOW ) != 0 )
+				continue;
+			if( S_ISDIR( st.st_mode ) ) {
+				pending.append( dirPrefix + name.name );
+			} else if( S_ISREG( st.st_mode ) ) {
+				FileEntry entry;
+				entry.path = prefix + QFile::decodeName( name.name );
+				entry.size = st.st_size;
+				if( !callback( entry ) ) {
+					closedir( dir );
+					return false;
+				}
+			}
+		}
+		closedir( dir );
+	}
+	return true;
+}
+
+#else
+
+bool FileWalker::walkDirectory( const QString &root, const Callback &callback )
+{
+	// The native directory listing already carries the sizes here.
+	QDirIterator it( root, QDir::Files | QDir::Hidden | QDir::NoSymLinks,
+					 QDirIterator::Subdirectories );
+	while( it.hasNext() ) {
+		it.next();
+		FileEntry entry;
+		entry.path = it.filePath();
+		entry.size = it.fileInfo().size();
+		if( !callback( entry ) )
+			return false;
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+#include <functional>
+
+/**
+ * Regular file found by the FileWalker.
+ */
+struct FileEntry
+{
+	QString path;
+	qint64 size = 0;
+};
+
+/**
+ * Recursive directory walk that reports files together with their size.
+ *
+ * On POSIX systems a directory is read completely first, then all entries
+ * are stat'ed in one go relative to the directory handle and reported in
+ * inode order, which is usually close to their order on disk. Symbolic
+ * links are not followed.
+ */
+class FileWalker
+{
+public:
+	// Returning false from the callback stops the walk.
+	typedef std::function<bool( const FileEntry & )> Callback;
+
+	static bool walk( const QStringList &paths, const Callback &callback );
+
+private:
+	static bool walkDirectory( const QString &root, const Callback &callback );
+};
@@ -0,0 +1,162 @@
+#include "hashalgorithm.h"
+
+#include <QtCore/QIODevice>
+#include <QtCore/QFile>
+
+#include <vector>
+
+#include "trace.h"
+
+#define READ_SIZE (1024 * 1024)
+
+namespace {
+
+struct StreamBackend
+{
+	template<class Sink>
+	static bool read( QIODevice *input, HashMonitor *monitor, Sink &sink )
+	{
+		// Reused by every kernel running on this thread.
+		thread_local std::vector<char> buf( READ_SIZE );
+
+		quint64 done = 0;
+		qint64 nread = 0;
+		for( ;; ) {
+			{
+				Trace::Span span( "read" );
+				nread = input->read( buf.data(), qint64( buf.size() ) );
+				span.setArg( nread );
+			}
+			if( nread <= 0 )
+				break;
+			{
+				Trace::Span span( "update", nread );
+				sink( (const CryptoPP::byte*)buf.data(), std::size_t( nread ) );
+			}
+			done += nread;
+			if( monitor && !monitor->update( done ) )
+				return false;
+		}
+		return nread == 0;
+	}
+};
+
+struct MappedBackend
+{
+	template<class Sink>
+	static bool read( QIODevice *input, HashMonitor *monitor, Sink &sink )
+	{
+		QFile *file = qobject_cast<QFile*>( input );
+		const qint64 size = file ? file->size() - file->pos() : 0;
+		uchar *map = size > 0 ? file->map( file->pos(), size ) : nullptr;
+		if( !map )
+			return StreamBackend::read( input, monitor, sink );
+
+		// Hash in slices, so progress and aborts work like when streaming.
+		bool ok = true;
+		for( qint64 done = 0; done < size; ) {
+			const qint64 len = qMin<qint64>( READ_SIZE, size - done );
+			{
+				// Includes the page faults, which do the actual reading.
+				Trace::Span span( "update", len );
+				sink( map + done, std::size_t( len ) );
+			}
+			done += len;
+			if( monitor && !monitor->update( done ) ) {
+				ok = false;
+				break;
+			}
+		}
+		file->unmap( map );
+		if( ok )
+			file->seek( file->pos() + size );
+		return ok;
+	}
+};
+
+template<class Hash, class Backend>
+QByteArray hashKernel( QIODevice *input, HashMonitor *monitor )
+{
+	// The kernel is specialised on the algorithm and the backend, not on the
+	// block transform. Crypto++ hashes each buffer through its own bulk
+	// path, which picks SHA-NI or ARMv8 code at run time, one indirect call
+	// per buffer is noise next to that.
+	Hash hash;
+	auto sink = [&hash]( const CryptoPP::byte *data, std::size_t len ) {
+		hash.Update( data, len );
+	};
+	if( !Backend::read( input, monitor, sink ) )
+		return QByteArray();
+
+	QByteArray digest( Hash::DIGESTSIZE, Qt::Uninitialized );
+	hash.Final( (CryptoPP::byte*)digest.data() );
+	return digest;
+}
+
+template<class Hash>
+QByteArray memoryKernel( const char *data, qsizetype size )
+{
+	// Final() restarts the context, so it is ready for the next buffer.
+	thread_local Hash hash;
+	Trace::Span span( "update", size );
+	hash.Update( (const CryptoPP::byte*)data, std::size_t( size ) );
+
+	QByteArray digest( Hash::DIGESTSIZE, Qt::Uninitialized );
+	hash.Final( (CryptoPP::byte*)digest.data() );
+	return digest;
+}
+
+template<class Hash>
+HashAlgorithm makeAlgorithm()
+{
+	// "SHA-256" becomes label "SHA256" and name "sha256".
+	QString label = QString::fromLatin1( Hash::StaticAlgorithmName() ).remove( QLatin1Char( '-' ) );
+
+	HashAlgorithm algorithm;
+	algorithm.name = label.toLower();
+	algorithm.label = label;
+	algorithm.digestSize = Hash::DIGESTSIZE;
+	algorithm.kernels[int( IOBackend::Stream )] = &hashKernel<Hash, StreamBackend>;
+	algorithm.kernels[int( IOBackend::Mapped )] = &hashKernel<Hash, MappedBackend>;
+	algorithm.bufferKernel = &memoryKernel<Hash>;
+	return algorithm;
+}
+
+template<class... Hashes>
+QVector<HashAlgorithm> makeRegistry( AlgorithmList<Hashes...> )
+{
+	return QVector<HashAlgorithm> { makeAlgorithm<Hashes>()... };
+}
+
+} // namespace
+
+QByteArray HashAlgorithm::hash( QIODevice *input, HashMonitor *monitor, IOBackend backend ) const
+{
+	return kernels[int( backend )]( input, monitor );
+}
+
+QByteArray HashAlgorithm::hashBuffer( const char *data, qsizetype size ) const
+{
+	return bufferKernel( data, size );
+}
+
+const QVector<HashAlgorithm> & HashAlgorithm::all()
+{
+	static const QVector<HashAlgorithm> registry = makeRegistry( Algorithms() );
+	return registry;
+}
+
+const HashAlgorithm * HashAlgorithm::find( const QString &name )
+{
+	const QString key = name.toLower().remove( QLatin1Char( '-' ) );
+	for( const HashAlgorithm &algorithm : all() ) {
+		if( algorithm.name == key )
+			return &algorithm;
+	}
+	return nullptr;
+}
+
+const HashAlgorithm * HashAlgorithm::defaultAlgorithm()
+{
+	return find( "sha256" );
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+#define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
+
+#include <cryptopp/sha.h>
+#include <cryptopp/md5.h>
+
+class QIODevice;
+
+/**
+ * All supported algorithms. Adding an algorithm means adding its Crypto++
+ * class here, name and label are derived from StaticAlgorithmName().
+ */
+template<class... Hashes> struct AlgorithmList {};
+
+using Algorithms = AlgorithmList<
+	CryptoPP::Weak::MD5,
+	CryptoPP::SHA1,
+	CryptoPP::SHA224,
+	CryptoPP::SHA256,
+	CryptoPP::SHA384,
+	CryptoPP::SHA512
+>;
+
+/**
+ * Ways of getting the data of an input device into the hash.
+ */
+enum class IOBackend {
+	Stream, // read() into a per-thread buffer, works for every device
+	Mapped, // memory-map files, falls back to Stream for other devices, SIGBUS if truncated meanwhile
+	Count
+};
+
+/**
+ * Receives progress of a running hash kernel.
+ */
+class HashMonitor
+{
+public:
+	virtual ~HashMonitor() {}
+
+	// Called after every read with the number of bytes hashed so far.
+	// Returning false aborts the kernel.
+	virtual bool update( quint64 done ) = 0;
+};
+
+/**
+ * Registry entry of one algorithm. Holds a dedicated read-and-hash kernel
+ * per I/O backend, the kernels use the concrete Crypto++ class, so no
+ * virtual call is made per buffer.
+ */
+struct HashAlgorithm
+{
+	typedef QByteArray (*Kernel)( QIODevice *, HashMonitor * );
+	typedef QByteArray (*BufferKernel)( const char *, qsizetype );
+
+	QString name;  // e.g. "sha256", used on the command line
+	QString label; // e.g. "SHA256", used in the user interface
+	int digestSize;
+	Kernel kernels[int( IOBackend::Count )];
+	BufferKernel bufferKernel;
+
+	// Hashes an open device to its end. Returns an empty array on read
+	// errors or when the monitor aborted.
+	QByteArray hash( QIODevice *input, HashMonitor *monitor = nullptr,
+					 IOBackend backend = IOBackend::Stream ) const;
+
+	// Hashes data already in memory with a context reused per thread.
+	QByteArray hashBuffer( const char *data, qsizetype size ) const;
+
+	static const QVector<HashAlgorithm> & all();
+	static const HashAlgorithm * find( const QString &name );
+	static const HashAlgorithm * defaultAlgorithm();
+};
@@ -0,0 +1,452 @@
+#include "hashdaemon.h"
+
+#include <QtCore/QCache>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QQueue>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QtEndian>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+
+#include <algorithm>
+#include <atomic>
+
+#include "hashalgorithm.h"
+
+#define MAX_FRAME (64 * 1024)
+#define DEFAULT_CACHE_SIZE 100000
+#define PROBE_TIMEOUT 1000
+
+namespace {
+
+void writeBytes( QDataStream &stream, const QByteArray &bytes )
+{
+	stream << quint32( bytes.size() );
+	stream.writeRawData( bytes.constData(), int( bytes.size() ) );
+}
+
+bool readBytes( QDataStream &stream, QByteArray *bytes )
+{
+	quint32 size = 0;
+	stream >> size;
+	if( stream.status() != QDataStream::Ok || size > MAX_FRAME )
+		return false;
+	bytes->resize( size );
+	return stream.readRawData( bytes->data(), int( size ) ) == int( size );
+}
+
+QByteArray frame( const QByteArray &payload )
+{
+	QByteArray out( 4, Qt::Uninitialized );
+	qToBigEndian<quint32>( quint32( payload.size() ), out.data() );
+	out += payload;
+	return out;
+}
+
+// Takes one complete frame from the buffer.
+bool takeFrame( QByteArray &buffer, QByteArray *payload )
+{
+	if( buffer.size() < 4 )
+		return false;
+	const quint32 size = qFromBigEndian<quint32>( buffer.constData() );
+	if( quint64( buffer.size() ) < 4 + quint64( size ) )
+		return false;
+	*payload = buffer.mid( 4, size );
+	buffer.remove( 0, 4 + size );
+	return true;
+}
+
+class JobMonitor : public HashMonitor
+{
+public:
+	JobMonitor( Throttle &throttle, const std::atomic<bool> &stop )
+		: throttle( throttle ), stop( stop ), reported( 0 )
+	{}
+
+	bool update( quint64 done ) override
+	{
+		throttle.acquire( done - reported, &stop );
+		reported = done;
+		return !stop;
+	}
+
+private:
+	Throttle &throttle;
+	const std::atomic<bool> &stop;
+	quint64 reported;
+};
+
+} // namespace
+
+class HashDaemon::Private {
+public:
+	struct Client {
+		QLocalSocket *socket = nullptr;
+		QByteArray buffer;
+		QQueue<QString> queue; // keys of jobs this client brought in
+	};
+
+	struct Waiter {
+		quint64 client;
+		quint32 id;
+		quint8 type;
+		QByteArray expected;
+	};
+
+	struct Job {
+		QString path;
+		const HashAlgorithm *algo = nullptr;
+		QVector<Waiter> waiters;
+		bool running = false;
+	};
+
+	struct CacheEntry {
+		QByteArray digest;
+		qint64 size;
+		qint64 mtime;
+	};
+
+	Private()
+		: cache( DEFAULT_CACHE_SIZE )
+	{}
+
+	QLocalServer server;
+	QString error;
+	QThreadPool pool;
+	Throttle throttle;
+	std::atomic<int> priority { Throttle::NormalPriority };
+	std::atomic<bool> stop { false };
+	std::atomic<quint64> hashed { 0 };
+	quint64 coalesced = 0;
+
+	QHash<quint64, Client> clients;
+	QList<quint64> order; // round-robin order of the clients
+	int next = 0;
+	quint64 nextClient = 1;
+
+	QHash<QString, Job> jobs; // queued and running, by algorithm and path
+	int running = 0;
+	QCache<QString, CacheEntry> cache;
+
+	static Response answer( const Waiter &waiter, const QByteArray &digest )
+	{
+		Response response;
+		response.id = waiter.id;
+		response.digest = digest;
+		if( digest.isEmpty() )
+			response.status = ReadError;
+		else if( waiter.type == VerifyRequest && digest != waiter.expected )
+			response.status = Mismatch;
+		return response;
+	}
+};
+
+HashDaemon::HashDaemon( QObject *parent )
+	: QObject( parent ), d( new HashDaemon::Private() )
+{
+	d->server.setSocketOptions( QLocalServer::UserAccessOption );
+	connect( &d->server, SIGNAL( newConnection() ), this, SLOT( acceptConnections() ) );
+}
+
+HashDaemon::~HashDaemon()
+{
+	d->stop = true;
+	d->server.close();
+	d->pool.waitForDone();
+	delete d;
+}
+
+void HashDaemon::setMaxThreads( int count )
+{
+	d->pool.setMaxThreadCount( count > 0 ? count : QThread::idealThreadCount() );
+}
+
+void HashDaemon::setCacheSize( int entries )
+{
+	d->cache.setMaxCost( entries );
+}
+
+void HashDaemon::setPriority( Throttle::Priority priority )
+{
+	d->priority = priority;
+}
+
+void HashDaemon::setBandwidthLimit( double mbps )
+{
+	d->throttle.setLimit( mbps );
+}
+
+QString HashDaemon::defaultSocketName()
+{
+	return QString( "insaneSums-%1" ).arg( QDir::home().dirName() );
+}
+
+bool HashDaemon::listen( const QString &name )
+{
+	// A socket nobody answers on is left over from a daemon that did not
+	// shut down properly, a live one must keep its socket.
+	QLocalSocket probe;
+	probe.connectToServer( name );
+	if( probe.waitForConnected( PROBE_TIMEOUT ) ) {
+		d->error = "daemon already running";
+		return false;
+	}
+	d->error.clear();
+	QLocalServer::removeServer( name );
+	return d->server.listen( name );
+}
+
+QString HashDaemon::errorString() const
+{
+	return d->error.isEmpty() ? d->server.errorString() : d->error;
+}
+
+quint64 HashDaemon::hashedFiles() const
+{
+	return d->hashed;
+}
+
+quint64 HashDaemon::coalescedRequests() const
+{
+	return d->coalesced;
+}
+
+void HashDaemon::acceptConnections()
+{
+	while( QLocalSocket *socket = d->server.nextPendingConnection() ) {
+		const quint64 id = d->nextClient++;
+		Private::Client client;
+		client.socket = socket;
+		d->clients.insert( id, client );
+		d->order.append( id );
+
+		connect( socket, &QLocalSocket::readyRead, this, [this, id]() { readRequests( id ); } );
+		connect( socket, &QLocalSocket::disconnected, this, [this, id]() { removeClient( id ); } );
+	}
+}
+
+void HashDaemon::readRequests( quint64 client )
+{
+	auto it = d->clients.find( client );
+	if( it == d->clients.end() )
+		return;
+	it->buffer += it->socket->readAll();
+
+	for( ;; ) {
+		// The client table may change while handling a request.
+		it = d->clients.find( client );
+		if( it == d->clients.end() )
+			return;
+		if( it->buffer.size() >= 4 && qFromBigEndian<quint32>( it->buffer.constData() ) > MAX_FRAME ) {
+			it->buffer.clear();
+			it->socket->disconnectFromServer();
+			return;
+		}
+		Request request;
+		if( !decode( it->buffer, &request ) )
+			return;
+		handleRequest( client, request );
+	}
+}
+
+void HashDaemon::removeClient( quint64 client )
+{
+	auto it = d->clients.find( client );
+	if( it == d->clients.end() )
+		return;
+	const Private::Client removed = it.value();
+	d->clients.erase( it );
+	d->order.removeOne( client );
+	removed.socket->deleteLater();
+
+	// Drop the client's interest in all jobs. Jobs other clients are still
+	// waiting for move to the queue of one of them.
+	for( auto job = d->jobs.begin(); job != d->jobs.end(); ) {
+		job->waiters.erase( std::remove_if( job->waiters.begin(), job->waiters.end(),
+				[client]( const Private::Waiter &w ) { return w.client == client; } ),
+				job->waiters.end() );
+		if( job->waiters.isEmpty() && !job->running )
+			job = d->jobs.erase( job );
+		else
+			++job;
+	}
+	for( const QString &key : removed.queue ) {
+		auto job = d->jobs.find( key );
+		if( job != d->jobs.end() && !job->running )
+			d->clients[job->waiters.first().client].queue.enqueue( key );
+	}
+}
+
+void HashDaemon::handleRequest( quint64 client, const Request &request )
+{
+	Private::Waiter waiter { client, request.id, request.type, request.expected };
+
+	const HashAlgorithm *algo = HashAlgorithm::find( request.algorithm );
+	if( !algo || request.path.isEmpty() || (request.type != HashRequest && request.type != VerifyRequest) ) {
+		Response response;
+		response.status = BadRequest;
+		response.id = request.id;
+		reply( client, response );
+		return;
+	}
+
+	QFileInfo info( request.path );
+	if( !info.isFile() ) {
+		reply( client, Private::answer( waiter, QByteArray() ) );
+		return;
+	}
+
+	// Still valid cached digests are answered right away.
+	const QString key = algo->name + QLatin1Char( '\n' ) + info.canonicalFilePath();
+	Private::CacheEntry *entry = d->cache.object( key );
+	if( entry && entry->size == info.size() && entry->mtime == info.lastModified().toMSecsSinceEpoch() ) {
+		reply( client, Private::answer( waiter, entry->digest ) );
+		return;
+	}
+
+	// Someone already asked for this file, wait for the same read.
+	auto job = d->jobs.find( key );
+	if( job != d->jobs.end() ) {
+		job->waiters.append( waiter );
+		d->coalesced++;
+		return;
+	}
+
+	Private::Job newJob;
+	newJob.path = info.canonicalFilePath();
+	newJob.algo = algo;
+	newJob.waiters.append( waiter );
+	d->jobs.insert( key, newJob );
+	d->clients[client].queue.enqueue( key );
+	dispatch();
+}
+
+void HashDaemon::reply( quint64 client, const Response &response )
+{
+	auto it = d->clients.find( client );
+	if( it != d->clients.end() )
+		it->socket->write( encode( response ) );
+}
+
+void HashDaemon::dispatch()
+{
+	// Take one job per client in turn until the pool is busy.
+	int idle = 0;
+	while( d->running < d->pool.maxThreadCount() && idle < d->order.size() ) {
+		d->next %= d->order.size();
+		Private::Client &client = d->clients[d->order.at( d->next++ )];
+		if( client.queue.isEmpty() ) {
+			idle++;
+			continue;
+		}
+		idle = 0;
+
+		const QString key = client.queue.dequeue();
+		auto job = d->jobs.find( key );
+		if( job == d->jobs.end() || job->running )
+			continue;
+		job->running = true;
+		d->running++;
+
+		const QString path = job->path;
+		const HashAlgorithm *algo = job->algo;
+		d->pool.start( [this, key, path, algo]() {
+			Throttle::setCurrentThreadPriority( Throttle::Priority( d->priority.load() ) );
+
+			// Size and time are taken before reading, a file modified during
+			// the read is hashed again on the next request.
+			QByteArray digest;
+			qint64 size = -1;
+			qint64 mtime = 0;
+			QFile file( path );
+			if( !d->stop && file.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) ) {
+				const QFileInfo info( file );
+				size = info.size();
+				mtime = info.lastModified().toMSecsSinceEpoch();
+				d->hashed++;
+				JobMonitor monitor( d->throttle, d->stop );
+				digest = algo->hash( &file, &monitor );
+			}
+			QMetaObject::invokeMethod( this, [this, key, digest, size, mtime]() {
+				jobFinished( key, digest, size, mtime );
+			}, Qt::QueuedConnection );
+		} );
+	}
+}
+
+void HashDaemon::jobFinished( const QString &key, const QByteArray &digest, qint64 size, qint64 mtime )
+{
+	d->running--;
+
+	auto it = d->jobs.find( key );
+	if( it != d->jobs.end() ) {
+		const Private::Job job = it.value();
+		d->jobs.erase( it );
+
+		if( !digest.isEmpty() )
+			d->cache.insert( key, new Private::CacheEntry { digest, size, mtime } );
+		for( const Private::Waiter &waiter : job.waiters )
+			reply( waiter.client, Private::answer( waiter, digest ) );
+	}
+
+	dispatch();
+}
+
+QByteArray HashDaemon::encode( const Request &request )
+{
+	QByteArray payload;
+	QDataStream stream( &payload, QIODevice::WriteOnly );
+	stream << request.type << request.id;
+	writeBytes( stream, request.algorithm.toUtf8() );
+	writeBytes( stream, request.path.toUtf8() );
+	writeBytes( stream, request.expected );
+	return frame( payload );
+}
+
+QByteArray HashDaemon::encode( const Response &response )
+{
+	QByteArray payload;
+	QDataStream stream( &payload, QIODevice::WriteOnly );
+	stream << response.status << response.id;
+	writeBytes( stream, response.digest );
+	return frame( payload );
+}
+
+bool HashDaemon::decode( QByteArray &buffer, Request *request )
+{
+	QByteArray payload;
+	if( !takeFrame( buffer, &payload ) )
+		return false;
+
+	// Malformed requests still count as consumed, they get a BadRequest.
+	QDataStream stream( payload );
+	QByteArray algorithm, path;
+	stream >> request->type >> request->id;
+	if( stream.status() != QDataStream::Ok || !readBytes( stream, &algorithm )
+			|| !readBytes( stream, &path ) || !readBytes( stream, &request->expected ) ) {
+		request->type = 0;
+		return true;
+	}
+	request->algorithm = QString::fromUtf8( algorithm );
+	request->path = QString::fromUtf8( path );
+	return true;
+}
+
+bool HashDaemon::decode( QByteArray &buffer, Response *response )
+{
+	QByteArray payload;
+	if( !takeFrame( buffer, &payload ) )
+		return false;
+
+	QDataStream stream( payload );
+	stream >> response->status >> response->id;
+	if( stream.status() != QDataStream::Ok || !readBytes( stream, &response->digest ) )
+		response->status = BadRequest;
+	return true;
+}
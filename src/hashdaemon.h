@@ -0,0 +1,97 @@
+#pragma once
+#include <QtCore/QObject>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include "throttle.h"
+
+class QLocalSocket;
+
+/**
+ * Long-running hashing service for local clients.
+ *
+ * Clients connect to a QLocalServer (a Unix domain socket or named pipe)
+ * and send frames of a u32 payload length followed by the payload. All
+ * integers are big-endian, "bytes" is a u32 length followed by the data.
+ *
+ *   request:  u8 type | u32 id | bytes algorithm | bytes path (UTF-8) | bytes expected digest
+ *   response: u8 status | u32 id | bytes digest
+ *
+ * Responses may arrive in any order, the id ties them to their request.
+ *
+ * All clients share one worker pool and one digest cache. Cached digests
+ * are used as long as size and modification time of the file match.
+ * Concurrent requests for the same file and algorithm are coalesced into
+ * a single read, and clients are served round-robin, so one client
+ * queueing a whole tree does not starve the others.
+ */
+class HashDaemon : public QObject
+{
+	Q_OBJECT
+
+public:
+	enum RequestType : quint8 {
+		HashRequest = 1,
+		VerifyRequest = 2  // compares against the expected digest
+	};
+
+	enum Status : quint8 {
+		Ok = 0,
+		Mismatch = 1,
+		ReadError = 2,
+		BadRequest = 3
+	};
+
+	struct Request {
+		quint8 type = HashRequest;
+		quint32 id = 0;
+		QString algorithm;
+		QString path;
+		QByteArray expected;
+	};
+
+	struct Response {
+		quint8 status = Ok;
+		quint32 id = 0;
+		QByteArray digest;
+	};
+
+	HashDaemon( QObject *parent = nullptr );
+	~HashDaemon();
+
+	void setMaxThreads( int count );
+	void setCacheSize( int entries );
+	void setPriority( Throttle::Priority priority );
+	void setBandwidthLimit( double mbps );
+
+	bool listen( const QString &name );
+	QString errorString() const;
+
+	// Files read so far and requests that joined a read already queued or
+	// running for the same file.
+	quint64 hashedFiles() const;
+	quint64 coalescedRequests() const;
+
+	// Framing shared with clients. The decode functions consume one frame
+	// from the buffer and return false if it is incomplete or invalid.
+	static QByteArray encode( const Request &request );
+	static QByteArray encode( const Response &response );
+	static bool decode( QByteArray &buffer, Request *request );
+	static bool decode( QByteArray &buffer, Response *response );
+
+	static QString defaultSocketName();
+
+private slots:
+	void acceptConnections();
+
+private:
+	class Private;
+	Private *d;
+
+	void readRequests( quint64 client );
+	void removeClient( quint64 client );
+	void handleRequest( quint64 client, const Request &request );
+	void reply( quint64 client, const Response &response );
+	void dispatch();
+	void jobFinished( const QString &key, const QByteArray &digest, qint64 size, qint64 mtime );
+};
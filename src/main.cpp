@@ -1,10 +1,34 @@
+#include <QtCore/QCoreApplication>
 #include <QtWidgets/QApplication>
 #include "mainwindow.h"
+#include "commandline.h"
+#include "trace.h"
 
-int main(int argc, char *argv[])
+namespace {
+
+int run( int argc, char *argv[] )
 {
+	if( CommandLine::isHeadless( argc, argv ) ) {
+		QCoreApplication a( argc, argv );
+		return CommandLine::exec( a.arguments() );
+	}
+
 	QApplication a( argc, argv );
 	MainWindow w( nullptr, (Qt::WindowMinimizeButtonHint | Qt::WindowCloseButtonHint | Qt::MSWindowsFixedSizeDialogHint) & ~Qt::WindowMaximizeButtonHint );
 	w.show();
 	return a.exec();
 }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	// INSANESUMS_TRACE=file.json records a timeline for chrome://tracing.
+	const QString traceFile = qEnvironmentVariable( "INSANESUMS_TRACE" );
+	Trace::setEnabled( !traceFile.isEmpty() );
+
+	const int ret = run( argc, argv );
+	if( !traceFile.isEmpty() && !Trace::exportChromeTrace( traceFile ) )
+		qWarning( "Cannot write trace to %s", qPrintable( traceFile ) );
+	return ret;
+}
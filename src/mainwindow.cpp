@@ -15,16 +15,14 @@
 
 #include <QtWidgets/QFileDialog>
 
-#include <cryptopp/sha.h>
-#include <cryptopp/hex.h>
-
 #include "mainwindow.h"
 #include "cihash.h"
 #include "aboutdialog.h"
+#include "batchwindow.h"
 
 MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
         : QMainWindow( parent, flags )
-		, hash( NULL )
+		, hash( NULL ), backgroundAction( NULL )
 {
 	ui.setupUi( this );
 
@@ -41,38 +39,37 @@ MainWindow::MainWindow( QWidget *parent, Qt::WindowFlags flags )
 	// Connect About dialog.
 	connect( ui.actionAbout, SIGNAL( triggered() ), this, SLOT( showAbout() ) );
 
+	// Hashing whole directories happens in a separate batch window.
+	QAction *folderAction = new QAction( tr( "Hash Folder..." ), this );
+	connect( folderAction, SIGNAL( triggered() ), this, SLOT( openBatch() ) );
+	ui.menuFile->insertAction( ui.menuFile->actions().value( 1 ), folderAction );
+
 	ui.menuHash;
 
-	// Adding hash actions to the hashButton and Hash menu item.
-	QAction *hashAction = NULL;
-	// SHA224
-	hashAction = new QAction( tr( "SHA224" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA224() ) );
-	ui.hashButton->addAction( hashAction );
-	hashAction = new QAction( tr( "Calculate SHA224" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA224() ) );
-	ui.menuHash->addAction( hashAction );
-	// SHA256
-	hashAction = new QAction( tr( "SHA256" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA256() ) );
-	ui.hashButton->setDefaultAction( hashAction );
-	hashAction = new QAction( tr( "Calculate SHA256" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA256() ) );
-	ui.menuHash->addAction( hashAction );
-	// SHA284
-	hashAction = new QAction( tr( "SHA384" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA384() ) );
-	ui.hashButton->addAction( hashAction );
-	hashAction = new QAction( tr( "Calculate SHA384" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA384() ) );
-	ui.menuHash->addAction( hashAction );
-	// SHA512
-	hashAction = new QAction( tr( "SHA512" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA512() ) );
-	ui.hashButton->addAction( hashAction );
-	hashAction = new QAction( tr( "Calculate SHA512" ), this );
-	connect( hashAction, SIGNAL( triggered() ), this, SLOT( processSHA512() ) );
-	ui.menuHash->addAction( hashAction );
+	// Adding hash actions to the hashButton and Hash menu item. MD5 and
+	// SHA1 have their own buttons, all other algorithms go to the hashButton.
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		if( algo.name == "md5" || algo.name == "sha1" )
+			continue;
+		const QString name = algo.name;
+		QAction *hashAction = new QAction( algo.label, this );
+		hashAction->setData( name );
+		connect( hashAction, &QAction::triggered, this, [this, name]() { processAlgorithm( name ); } );
+		if( &algo == HashAlgorithm::defaultAlgorithm() )
+			ui.hashButton->setDefaultAction( hashAction );
+		else
+			ui.hashButton->addAction( hashAction );
+		hashAction = new QAction( tr( "Calculate %1" ).arg( algo.label ), this );
+		connect( hashAction, &QAction::triggered, this, [this, name]() { processAlgorithm( name ); } );
+		ui.menuHash->addAction( hashAction );
+	}
+
+	// Single files can be hashed with low priority, like batches.
+	ui.menuHash->addSeparator();
+	backgroundAction = new QAction( tr( "Hash in Background" ), this );
+	backgroundAction->setCheckable( true );
+	backgroundAction->setToolTip( tr( "Lowest CPU and I/O priority while hashing." ) );
+	ui.menuHash->addAction( backgroundAction );
 
 	// Handle application parameters.
 	QStringList args = QCoreApplication::arguments();
@@ -170,6 +167,8 @@ void MainWindow::processHash( CIHash *h )
 		delete hash;
 	hash = h;
 	hash->setInput( file );
+	if( backgroundAction->isChecked() )
+		hash->setThrottle( &throttle );
 	connect( hash, SIGNAL( progressChanged( float ) ),
 			this, SLOT( updateProgress( const float ) ) );
 	connect( hash, SIGNAL( digest( QByteArray ) ),
@@ -183,12 +182,12 @@ void MainWindow::processHash( CIHash *h )
 
 void MainWindow::on_md5Button_clicked()
 {
-	processHash( CIHash::createMD5() );
+	processAlgorithm( "md5" );
 }
 
 void MainWindow::on_sha1Button_clicked()
 {
-	processHash( CIHash::createSHA1() );
+	processAlgorithm( "sha1" );
 }
 
 void MainWindow::on_hashButton_triggered( QAction * a )
@@ -200,62 +199,13 @@ void MainWindow::on_hashButton_triggered( QAction * a )
 	hashButtonMutex.unlock();
 }
 
-void MainWindow::processSHA256()
-{
-	processHash( CIHash::createSHA256() );
-}
-
-void MainWindow::processSHA224()
-{
-	processHash( CIHash::createSHA224() );
-}
-
-void MainWindow::processSHA384()
+void MainWindow::processAlgorithm( const QString &name )
 {
-	processHash( CIHash::createSHA384() );
+	CIHash *h = CIHash::create( name );
+	if( h )
+		processHash( h );
 }
 
-void MainWindow::processSHA512()
-{
-	processHash( CIHash::createSHA512() );
-}
-
-/*
-void MainWindow::processTiger()
-{
-	processHash( CIHash::createTiger() );
-}
-
-void MainWindow::processWhirlpool()
-{
-	processHash( CIHash::createWhirlpool() );
-}
-
-void MainWindow::processRIPEMD160()
-{
-	processHash( CIHash::createRIPEMD160() );
-}
-
-void MainWindow::processRIPEMD320()
-{
-	processHash( CIHash::createRIPEMD320() );
-}
-
-void MainWindow::processRIPEMD128()
-{
-	processHash( CIHash::createRIPEMD128() );
-}
-
-void MainWindow::processRIPEMD256()
-{
-	processHash( CIHash::createRIPEMD256() );
-}
-
-void MainWindow::processCRC32()
-{
-	processHash( CIHash::createCRC32() );
-}*/
-
 void MainWindow::showAbout()
 {
 	QPointer<AboutDialog> d = new AboutDialog( this );
@@ -267,6 +217,20 @@ void MainWindow::showAbout()
 	delete d;
 }
 
+void MainWindow::openBatch()
+{
+	QString dir = QFileDialog::getExistingDirectory( this, tr( "Hash Folder" ) );
+	if( dir.isEmpty() )
+		return;
+
+	// Use the algorithm currently selected on the hash button.
+	QString algo = ui.hashButton->defaultAction()->data().toString();
+	BatchWindow *w = new BatchWindow( this );
+	w->setAttribute( Qt::WA_DeleteOnClose );
+	w->show();
+	w->start( QStringList() << dir, algo );
+}
+
 void MainWindow::on_cancelButton_clicked()
 {
 	hash->stopProcess();
@@ -438,20 +402,7 @@ void MainWindow::handleArguments( const QStringList & args ) {
         ui.fileEdit->setText( path );
 
         // ... and calculate a hash if available.
-        algo = algo.toLower();
-        if( algo == "md5" ) {
-            processHash( CIHash::createMD5() );
-        } else if( algo == "sha1" ) {
-            processHash( CIHash::createSHA1() );
-        } else if( algo == "sha224" ) {
-            processSHA224();
-        } else if( algo == "sha256" ) {
-            processSHA256();
-        } else if( algo == "sha384" ) {
-            processSHA384();
-        } else if( algo == "sha512" ) {
-            processSHA512();
-        }
+        processAlgorithm( algo );
     }
 }
 
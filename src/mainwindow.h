@@ -27,6 +27,8 @@ private:
 	Ui::MainWindowClass ui;
 	CIHash *hash;
 	QMutex hashButtonMutex;
+	QAction *backgroundAction;
+	Throttle throttle; // unlimited, only carries the background priority
 
 private slots:
         void handleArguments( const QStringList & );
@@ -40,21 +42,10 @@ public slots:
 	void on_compEdit_textChanged();
 	void reset();
 
-	void processSHA256();
-	void processSHA224();
-	void processSHA384();
-	void processSHA512();
-	/*
-	void processTiger();
-	void processWhirlpool();
-	void processRIPEMD160();
-	void processRIPEMD320();
-	void processRIPEMD128();
-	void processRIPEMD256();
-	void processCRC32();
-	*/
-	
+	void processAlgorithm( const QString & );
+
 	void showAbout();
+	void openBatch();
 
 	void processHash( CIHash * );
 	void setHash( const QString & );
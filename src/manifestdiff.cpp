@@ -0,0 +1,627 @@
+#include "manifestdiff.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHashFunctions>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#define READ_BLOCK (4 * 1024 * 1024)
+#define RUN_READ_SIZE (256 * 1024)
+#define MIN_RUN_READ_SIZE (16 * 1024)
+#define MAX_MERGE_RUNS 64
+#define DEFAULT_MEMORY_BUDGET (256 * 1024 * 1024)
+#define MAX_DIGEST_SIZE 64
+#define PATH_HASH_SIZE 16
+#define OFFSET_SIZE 8
+
+namespace {
+
+int hexValue( char c )
+{
+	if( c >= '0' && c <= '9' )
+		return c - '0';
+	if( c >= 'a' && c <= 'f' )
+		return c - 'a' + 10;
+	if( c >= 'A' && c <= 'F' )
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool decodeHex( const char *hex, qsizetype size, QByteArray *out )
+{
+	if( size == 0 || size % 2 || size / 2 > MAX_DIGEST_SIZE )
+		return false;
+	out->resize( size / 2 );
+	for( qsizetype i = 0; i < size; i += 2 ) {
+		const int hi = hexValue( hex[i] );
+		const int lo = hexValue( hex[i + 1] );
+		if( hi < 0 || lo < 0 )
+			return false;
+		(*out)[i / 2] = char( hi << 4 | lo );
+	}
+	return true;
+}
+
+QByteArray unescape( const char *path, qsizetype size )
+{
+	QByteArray out;
+	out.reserve( size );
+	for( qsizetype i = 0; i < size; i++ ) {
+		if( path[i] == '\\' && i + 1 < size ) {
+			const char c = path[++i];
+			out += c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+		} else {
+			out += path[i];
+		}
+	}
+	return out;
+}
+
+const char* find( const char *begin, const char *end, const char *needle, qsizetype size )
+{
+	const char *pos = std::search( begin, end, needle, needle + size );
+	return pos == end ? nullptr : pos;
+}
+
+const char* findLast( const char *begin, const char *end, const char *needle, qsizetype size )
+{
+	const char *pos = std::find_end( begin, end, needle, needle + size );
+	return pos == end ? nullptr : pos;
+}
+
+// Two differently seeded 64 bit hashes, collisions are out of reach even
+// for billions of paths.
+void hashPath( const QByteArray &path, char *out )
+{
+	const quint64 a = quint64( qHash( QByteArrayView( path ), size_t( 0x9e3779b97f4a7c15ull ) ) );
+	const quint64 b = quint64( qHash( QByteArrayView( path ), size_t( 0xc2b2ae3d27d4eb4full ) ) );
+	qToBigEndian( a, out );
+	qToBigEndian( b, out + 8 );
+}
+
+/**
+ * Sorts fixed-size records on a key at their start. Records are collected
+ * in memory up to the budget, then sorted and spilled to a temporary file.
+ * After finish() the records come out in key order, merged from all runs.
+ * Runs are closed until they are merged, at most MAX_MERGE_RUNS at a time.
+ * More runs are merged in several passes.
+ */
+class RecordSorter
+{
+public:
+	RecordSorter( int recordSize, int keySize, qint64 memory )
+		: recordSize( recordSize ), keySize( keySize ), memory( memory ),
+		  capacity( qMax<qint64>( 1024, memory / (recordSize + qint64( sizeof( quint32 ) )) ) )
+	{}
+
+	QString error;
+
+	bool add( const char *record )
+	{
+		if( count == capacity && !spill() )
+			return false;
+		// Reserved once, untouched pages of a small input cost nothing.
+		if( records.capacity() == 0 )
+			records.reserve( std::size_t( capacity * recordSize ) );
+		records.insert( records.end(), record, record + recordSize );
+		count++;
+		return true;
+	}
+
+	bool finish()
+	{
+		if( runs.empty() ) {
+			sortRecords();
+			return true;
+		}
+		if( count && !spill() )
+			return false;
+		std::vector<char>().swap( records );
+
+		// Merge groups of runs into longer runs until the rest fits into
+		// one pass. Groups are consecutive, so equal keys keep their order.
+		while( runs.size() > MAX_MERGE_RUNS ) {
+			std::vector<QString> merged;
+			for( std::size_t first = 0; first < runs.size(); first += MAX_MERGE_RUNS ) {
+				const std::size_t end = qMin<std::size_t>( first + MAX_MERGE_RUNS, runs.size() );
+				QFile file;
+				if( !createRun( file ) || !startMerge( first, end ) )
+					return false;
+
+				std::vector<char> block;
+				block.reserve( RUN_READ_SIZE + recordSize );
+				while( const char *record = next() ) {
+					block.insert( block.end(), record, record + recordSize );
+					if( block.size() >= std::size_t( RUN_READ_SIZE ) && !writeBlock( file, block ) )
+						return false;
+				}
+				if( !writeBlock( file, block ) || !file.flush() ) {
+					error = file.errorString();
+					return false;
+				}
+				file.close();
+
+				readers.clear();
+				for( std::size_t i = first; i < end; i++ )
+					QFile::remove( runs[i] );
+				merged.push_back( file.fileName() );
+			}
+			runs.swap( merged );
+		}
+		return startMerge( 0, runs.size() );
+	}
+
+	// Returns the next record in key order, or nullptr at the end. The
+	// pointer stays valid until the next call.
+	const char* next()
+	{
+		if( runs.empty() )
+			return pos < count ? records.data() + qsizetype( order[pos++] ) * recordSize : nullptr;
+
+		if( last >= 0 && readers[last].advance( recordSize ) )
+			pushHeap( last );
+		last = -1;
+		if( heap.empty() )
+			return nullptr;
+		std::pop_heap( heap.begin(), heap.end(), greater() );
+		last = heap.back();
+		heap.pop_back();
+		return readers[last].current();
+	}
+
+private:
+	struct Reader
+	{
+		std::unique_ptr<QFile> file;
+		std::vector<char> buf;
+		qsizetype pos = 0;
+		qsizetype end = 0;
+
+		const char* current() const { return buf.data() + pos; }
+
+		bool refill( int recordSize )
+		{
+			const qint64 nread = file->read( buf.data(), qint64( buf.size() ) );
+			pos = 0;
+			end = nread > 0 ? nread - nread % recordSize : 0;
+			return end > 0;
+		}
+
+		bool advance( int recordSize )
+		{
+			pos += recordSize;
+			return pos < end || refill( recordSize );
+		}
+	};
+
+	int recordSize;
+	int keySize;
+	qint64 memory;
+	qint64 capacity;
+	int runCount = 0;
+	qint64 count = 0;
+	qint64 pos = 0;
+	std::vector<char> records;
+	std::vector<quint32> order;
+	std::unique_ptr<QTemporaryDir> runDir; // created with the first run
+	std::vector<QString> runs;
+	std::vector<Reader> readers;
+	std::vector<int> heap;
+	int last = -1;
+
+	// Min-heap on the key, equal keys come out in run order.
+	struct Greater
+	{
+		const std::vector<Reader> *readers;
+		int keySize;
+
+		bool operator()( int a, int b ) const
+		{
+			const int cmp = std::memcmp( (*readers)[a].current(), (*readers)[b].current(), std::size_t( keySize ) );
+			return cmp > 0 || (cmp == 0 && a > b);
+		}
+	};
+
+	Greater greater() const
+	{
+		return Greater { &readers, keySize };
+	}
+
+	void pushHeap( int reader )
+	{
+		heap.push_back( reader );
+		std::push_heap( heap.begin(), heap.end(), greater() );
+	}
+
+	// Opens the runs [first, end) for merging through next(). The read
+	// buffers share the budget the in-memory records used before.
+	bool startMerge( std::size_t first, std::size_t end )
+	{
+		readers.clear();
+		heap.clear();
+		last = -1;
+
+		const qint64 perRun = qBound<qint64>( MIN_RUN_READ_SIZE, memory / qint64( end - first ), RUN_READ_SIZE );
+		const qsizetype bufSize = qMax<qsizetype>( 1, perRun / recordSize ) * recordSize;
+		for( std::size_t i = first; i < end; i++ ) {
+			Reader reader;
+			reader.file = std::make_unique<QFile>( runs[i] );
+			if( !reader.file->open( QIODevice::ReadOnly ) ) {
+				error = reader.file->errorString();
+				return false;
+			}
+			reader.buf.resize( std::size_t( bufSize ) );
+			readers.push_back( std::move( reader ) );
+		}
+		for( int i = 0; i < int( readers.size() ); i++ ) {
+			if( readers[i].refill( recordSize ) )
+				pushHeap( i );
+		}
+		return true;
+	}
+
+	bool createRun( QFile &file )
+	{
+		if( !runDir ) {
+			runDir = std::make_unique<QTemporaryDir>();
+			if( !runDir->isValid() ) {
+				error = runDir->errorString();
+				return false;
+			}
+		}
+		file.setFileName( runDir->filePath( QString::number( runCount++ ) ) );
+		if( !file.open( QIODevice::WriteOnly ) ) {
+			error = file.errorString();
+			return false;
+		}
+		return true;
+	}
+
+	bool writeBlock( QFile &file, std::vector<char> &block )
+	{
+		const bool ok = file.write( block.data(), qint64( block.size() ) ) == qint64( block.size() );
+		if( !ok )
+			error = file.errorString();
+		block.clear();
+		return ok;
+	}
+
+	void sortRecords()
+	{
+		order.resize( std::size_t( count ) );
+		std::iota( order.begin(), order.end(), 0u );
+		const char *data = records.data();
+		const int size = recordSize;
+		const int key = keySize;
+		std::sort( order.begin(), order.end(), [data, size, key]( quint32 a, quint32 b ) {
+			const int cmp = std::memcmp( data + qsizetype( a ) * size, data + qsizetype( b ) * size, std::size_t( key ) );
+			return cmp < 0 || (cmp == 0 && a < b);
+		} );
+		pos = 0;
+	}
+
+	bool spill()
+	{
+		sortRecords();
+		QFile file;
+		if( !createRun( file ) )
+			return false;
+
+		std::vector<char> block;
+		block.reserve( RUN_READ_SIZE + recordSize );
+		for( quint32 index : order ) {
+			const char *record = records.data() + qsizetype( index ) * recordSize;
+			block.insert( block.end(), record, record + recordSize );
+			if( block.size() >= std::size_t( RUN_READ_SIZE ) && !writeBlock( file, block ) )
+				return false;
+		}
+		if( !writeBlock( file, block ) || !file.flush() ) {
+			error = file.errorString();
+			return false;
+		}
+		// Reopened for merging, so only the runs being merged hold a handle.
+		file.close();
+
+		runs.push_back( file.fileName() );
+		records.clear();
+		order.clear();
+		count = 0;
+		return true;
+	}
+};
+
+// Reads the path of a reported entry back from its manifest.
+class PathReader
+{
+public:
+	bool open( const QString &fileName )
+	{
+		file.setFileName( fileName );
+		return file.open( QIODevice::ReadOnly );
+	}
+
+	QString path( quint64 offset )
+	{
+		QByteArray path, digest;
+		if( !file.seek( qint64( offset ) ) )
+			return QString();
+		QByteArray line = file.readLine();
+		while( line.endsWith( '\n' ) || line.endsWith( '\r' ) )
+			line.chop( 1 );
+		ManifestDiff::parseLine( line, &path, &digest );
+		return QString::fromUtf8( path );
+	}
+
+private:
+	QFile file;
+};
+
+} // namespace
+
+class ManifestDiff::Private {
+public:
+	qint64 memoryBudget = DEFAULT_MEMORY_BUDGET;
+	Stats stats;
+	QString error;
+	int digestSize = 0;
+
+	bool fail( const QString &message )
+	{
+		if( error.isEmpty() )
+			error = message;
+		return false;
+	}
+
+	// Calls lineFunc( line, offset ) for every line of the file, empty ones
+	// included so callers can count lines.
+	template<class LineFunc>
+	bool forEachLine( const QString &fileName, LineFunc lineFunc )
+	{
+		QFile file( fileName );
+		if( !file.open( QIODevice::ReadOnly ) )
+			return fail( fileName + ": " + file.errorString() );
+
+		QByteArray block;
+		qint64 blockOffset = 0;
+		for( ;; ) {
+			const qsizetype kept = block.size();
+			block.resize( kept + READ_BLOCK );
+			const qint64 nread = file.read( block.data() + kept, READ_BLOCK );
+			if( nread < 0 )
+				return fail( fileName + ": " + file.errorString() );
+			block.resize( kept + nread );
+
+			// Whole lines only, the rest waits for the next block.
+			const char *data = block.constData();
+			qsizetype start = 0;
+			for( ;; ) {
+				const char *nl = static_cast<const char*>( std::memchr( data + start, '\n', std::size_t( block.size() - start ) ) );
+				if( !nl && nread > 0 )
+					break;
+				const qsizetype end = nl ? nl - data : block.size();
+				if( (nl || end > start) && !lineFunc( QByteArrayView( data + start, end - start ), quint64( blockOffset + start ) ) )
+					return false;
+				start = end + 1;
+				if( !nl || start >= block.size() )
+					break;
+			}
+			if( nread == 0 )
+				return true;
+			start = qMin( start, block.size() );
+			block.remove( 0, start );
+			blockOffset += start;
+		}
+	}
+
+	bool load( const QString &fileName, RecordSorter &sorter, quint64 *count )
+	{
+		QByteArray path, digest;
+		char record[PATH_HASH_SIZE + OFFSET_SIZE + MAX_DIGEST_SIZE];
+		quint64 lineNumber = 0;
+		return forEachLine( fileName, [&]( QByteArrayView line, quint64 offset ) {
+			lineNumber++;
+			if( line.endsWith( '\r' ) )
+				line.chop( 1 );
+			if( line.isEmpty() || line.startsWith( '#' ) )
+				return true;
+			if( !parseLine( line, &path, &digest ) )
+				return fail( QString( "%1:%2: not a checksum line" ).arg( fileName ).arg( lineNumber ) );
+			if( digest.size() != digestSize )
+				return fail( QString( "%1:%2: digest size differs from the first entry" ).arg( fileName ).arg( lineNumber ) );
+
+			hashPath( path, record );
+			qToBigEndian( offset, record + PATH_HASH_SIZE );
+			std::memcpy( record + PATH_HASH_SIZE + OFFSET_SIZE, digest.constData(), std::size_t( digestSize ) );
+			(*count)++;
+			return sorter.add( record ) || fail( sorter.error );
+		} );
+	}
+
+	// The digest size of the first entry found in either manifest.
+	bool detectDigestSize( const QString &fileName )
+	{
+		QByteArray path, digest;
+		const bool ok = forEachLine( fileName, [&]( QByteArrayView line, quint64 ) {
+			if( line.endsWith( '\r' ) )
+				line.chop( 1 );
+			if( line.isEmpty() || line.startsWith( '#' ) || !parseLine( line, &path, &digest ) )
+				return true;
+			digestSize = int( digest.size() );
+			return false;
+		} );
+		return ok || digestSize;
+	}
+};
+
+ManifestDiff::ManifestDiff()
+	: d( new ManifestDiff::Private() )
+{
+}
+
+ManifestDiff::~ManifestDiff()
+{
+	delete d;
+}
+
+void ManifestDiff::setMemoryBudget( qint64 bytes )
+{
+	d->memoryBudget = bytes;
+}
+
+ManifestDiff::Stats ManifestDiff::stats() const
+{
+	return d->stats;
+}
+
+QString ManifestDiff::errorString() const
+{
+	return d->error;
+}
+
+bool ManifestDiff::parseLine( QByteArrayView line, QByteArray *path, QByteArray *digest )
+{
+	const char *begin = line.data();
+	const char *end = begin + line.size();
+	const bool escaped = begin != end && *begin == '\\';
+	if( escaped )
+		begin++;
+
+	const char *pathBegin = nullptr;
+	const char *pathEnd = end;
+	const char *space = std::find( begin, end, ' ' );
+	if( space != end && space + 1 != end && (space[1] == ' ' || space[1] == '*')
+			&& decodeHex( begin, space - begin, digest ) ) {
+		// coreutils, "*" marks binary mode.
+		pathBegin = space + 2;
+	} else {
+		// BSD, the algorithm name has no spaces and hex digits no parentheses.
+		const char *open = find( begin, end, " (", 2 );
+		const char *close = findLast( begin, end, ") = ", 4 );
+		if( !open || !close || close < open + 2 || !decodeHex( close + 4, end - close - 4, digest ) )
+			return false;
+		pathBegin = open + 2;
+		pathEnd = close;
+	}
+
+	if( escaped )
+		*path = unescape( pathBegin, pathEnd - pathBegin );
+	else
+		*path = QByteArray( pathBegin, pathEnd - pathBegin );
+	return !path->isEmpty();
+}
+
+bool ManifestDiff::run( const QString &before, const QString &after, const Callback &callback )
+{
+	d->stats = Stats();
+	d->error.clear();
+	d->digestSize = 0;
+
+	if( !d->detectDigestSize( before ) || (!d->digestSize && !d->detectDigestSize( after )) )
+		return false;
+	if( !d->digestSize )
+		return true; // Both empty.
+
+	// A quarter of the budget for each of the four sorters.
+	const int digestSize = d->digestSize;
+	const int pathRecordSize = PATH_HASH_SIZE + OFFSET_SIZE + digestSize;
+	const int moveRecordSize = digestSize + PATH_HASH_SIZE + OFFSET_SIZE;
+	const qint64 memory = d->memoryBudget / 4;
+
+	RecordSorter beforeSorter( pathRecordSize, PATH_HASH_SIZE, memory );
+	RecordSorter afterSorter( pathRecordSize, PATH_HASH_SIZE, memory );
+	if( !d->load( before, beforeSorter, &d->stats.before ) || !d->load( after, afterSorter, &d->stats.after ) )
+		return false;
+	if( !beforeSorter.finish() )
+		return d->fail( beforeSorter.error );
+	if( !afterSorter.finish() )
+		return d->fail( afterSorter.error );
+
+	PathReader beforePaths, afterPaths;
+	if( !beforePaths.open( before ) || !afterPaths.open( after ) )
+		return d->fail( "Cannot reopen the manifests" );
+
+	// Duplicate paths within one manifest count once.
+	auto nextUnique = []( RecordSorter &sorter, const char *previous ) {
+		const char *record = sorter.next();
+		while( record && previous && std::memcmp( record, previous, PATH_HASH_SIZE ) == 0 )
+			record = sorter.next();
+		return record;
+	};
+	auto offsetOf = []( const char *record, int at ) {
+		return qFromBigEndian<quint64>( record + at );
+	};
+
+	// Entries only on one side are keyed by digest for the move detection.
+	RecordSorter removedSorter( moveRecordSize, digestSize + PATH_HASH_SIZE, memory );
+	RecordSorter addedSorter( moveRecordSize, digestSize + PATH_HASH_SIZE, memory );
+	char moveRecord[MAX_DIGEST_SIZE + PATH_HASH_SIZE + OFFSET_SIZE];
+	auto byDigest = [&]( const char *record ) {
+		std::memcpy( moveRecord, record + PATH_HASH_SIZE + OFFSET_SIZE, std::size_t( digestSize ) );
+		std::memcpy( moveRecord + digestSize, record, PATH_HASH_SIZE + OFFSET_SIZE );
+		return moveRecord;
+	};
+
+	// Copies are kept, since next() may reuse the memory of the last record.
+	std::vector<char> lastA( pathRecordSize ), lastB( pathRecordSize );
+	const char *a = nextUnique( beforeSorter, nullptr );
+	const char *b = nextUnique( afterSorter, nullptr );
+	while( a || b ) {
+		const int cmp = !a ? 1 : !b ? -1 : std::memcmp( a, b, PATH_HASH_SIZE );
+		if( cmp < 0 ) {
+			if( !removedSorter.add( byDigest( a ) ) )
+				return d->fail( removedSorter.error );
+		} else if( cmp > 0 ) {
+			if( !addedSorter.add( byDigest( b ) ) )
+				return d->fail( addedSorter.error );
+		} else if( std::memcmp( a + PATH_HASH_SIZE + OFFSET_SIZE, b + PATH_HASH_SIZE + OFFSET_SIZE, std::size_t( digestSize ) ) != 0 ) {
+			d->stats.modified++;
+			callback( Modified, afterPaths.path( offsetOf( b, PATH_HASH_SIZE ) ), QString() );
+		} else {
+			d->stats.unchanged++;
+		}
+
+		if( cmp <= 0 ) {
+			std::memcpy( lastA.data(), a, std::size_t( pathRecordSize ) );
+			a = nextUnique( beforeSorter, lastA.data() );
+		}
+		if( cmp >= 0 ) {
+			std::memcpy( lastB.data(), b, std::size_t( pathRecordSize ) );
+			b = nextUnique( afterSorter, lastB.data() );
+		}
+	}
+	if( !removedSorter.finish() )
+		return d->fail( removedSorter.error );
+	if( !addedSorter.finish() )
+		return d->fail( addedSorter.error );
+
+	// Same content on both sides is a move, paired in path hash order when
+	// several files share a digest.
+	const int offsetAt = digestSize + PATH_HASH_SIZE;
+	const char *removed = removedSorter.next();
+	const char *added = addedSorter.next();
+	while( removed || added ) {
+		const int cmp = !removed ? 1 : !added ? -1 : std::memcmp( removed, added, std::size_t( digestSize ) );
+		if( cmp < 0 ) {
+			d->stats.removed++;
+			callback( Removed, beforePaths.path( offsetOf( removed, offsetAt ) ), QString() );
+			removed = removedSorter.next();
+		} else if( cmp > 0 ) {
+			d->stats.added++;
+			callback( Added, afterPaths.path( offsetOf( added, offsetAt ) ), QString() );
+			added = addedSorter.next();
+		} else {
+			d->stats.moved++;
+			callback( Moved, afterPaths.path( offsetOf( added, offsetAt ) ),
+					  beforePaths.path( offsetOf( removed, offsetAt ) ) );
+			removed = removedSorter.next();
+			added = addedSorter.next();
+		}
+	}
+	return true;
+}
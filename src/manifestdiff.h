@@ -0,0 +1,64 @@
+#pragma once
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QByteArrayView>
+
+#include <functional>
+
+/**
+ * Compares two checksum manifests without touching the files they list.
+ *
+ * Both manifests are parsed into fixed-size binary records of a 128 bit
+ * path hash, the line offset and the raw digest. The records are sorted
+ * externally, in runs that spill to temporary files once the memory
+ * budget is used up, and joined by a sorted merge on the path hash.
+ * Removed and added entries are joined a second time on the digest, pairs
+ * with the same content are reported as moved.
+ *
+ * Paths are only read back from the manifests for entries that are
+ * reported. Changes come out in hash order, not in path order.
+ */
+class ManifestDiff
+{
+public:
+	enum Change {
+		Added,
+		Removed,
+		Modified,
+		Moved
+	};
+
+	struct Stats
+	{
+		quint64 before = 0;
+		quint64 after = 0;
+		quint64 unchanged = 0;
+		quint64 added = 0;
+		quint64 removed = 0;
+		quint64 modified = 0;
+		quint64 moved = 0;
+	};
+
+	// For moves, path is the new and oldPath the previous location.
+	typedef std::function<void( Change change, const QString &path, const QString &oldPath )> Callback;
+
+	ManifestDiff();
+	~ManifestDiff();
+
+	void setMemoryBudget( qint64 bytes );
+
+	bool run( const QString &before, const QString &after, const Callback &callback );
+	Stats stats() const;
+	QString errorString() const;
+
+	// Parses one line in coreutils ("<hex>  <path>", "<hex> *<path>") or
+	// BSD ("<ALGO> (<path>) = <hex>") format, including the backslash
+	// escaping of coreutils. The line must not contain the line break.
+	static bool parseLine( QByteArrayView line, QByteArray *path, QByteArray *digest );
+
+private:
+	Q_DISABLE_COPY( ManifestDiff )
+
+	class Private;
+	Private *d;
+};
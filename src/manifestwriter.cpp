@@ -0,0 +1,551 @@
+#include "manifestwriter.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "hashalgorithm.h"
+
+#define WRITE_SIZE (4 * 1024 * 1024)
+#define SYNC_INTERVAL (256 * 1024 * 1024)
+#define RUN_SIZE (64 * 1024 * 1024)
+#define MAX_MERGE_RUNS 64
+
+namespace {
+
+// Two characters per byte value, so encoding is one copy per input byte.
+struct HexTable
+{
+	char pairs[512];
+
+	constexpr HexTable()
+		: pairs()
+	{
+		const char digits[] = "0123456789abcdef";
+		for( int i = 0; i < 256; i++ ) {
+			pairs[2 * i] = digits[i >> 4];
+			pairs[2 * i + 1] = digits[i & 15];
+		}
+	}
+};
+
+constexpr HexTable HEX;
+
+bool keyLess( const char *a, quint32 aSize, const char *b, quint32 bSize )
+{
+	const int cmp = std::memcmp( a, b, qMin( aSize, bSize ) );
+	return cmp < 0 || (cmp == 0 && aSize < bSize);
+}
+
+void appendU32( QByteArray &out, quint32 value )
+{
+	char buf[4];
+	qToBigEndian( value, buf );
+	out.append( buf, 4 );
+}
+
+// coreutils escapes backslashes and newlines and marks such lines with a
+// leading backslash.
+bool needsEscape( const QByteArray &path )
+{
+	return path.contains( '\\' ) || path.contains( '\n' ) || path.contains( '\r' );
+}
+
+void appendEscaped( QByteArray &out, const QByteArray &path )
+{
+	for( char c : path ) {
+		if( c == '\\' )
+			out += "\\\\";
+		else if( c == '\n' )
+			out += "\\n";
+		else if( c == '\r' )
+			out += "\\r";
+		else
+			out += c;
+	}
+}
+
+void appendJsonString( QByteArray &out, const QByteArray &str )
+{
+	out += '"';
+	for( char c : str ) {
+		if( c == '"' || c == '\\' ) {
+			out += '\\';
+			out += c;
+		} else if( uchar( c ) < 0x20 ) {
+			out += "\\u00";
+			out += HEX.pairs[2 * uchar( c )];
+			out += HEX.pairs[2 * uchar( c ) + 1];
+		} else {
+			out += c;
+		}
+	}
+	out += '"';
+}
+
+// Sequential reader of a spilled run.
+struct RunReader
+{
+	std::unique_ptr<QFile> file;
+	QByteArray key;
+	QByteArray line;
+
+	bool readBytes( QByteArray &out )
+	{
+		char buf[4];
+		if( file->read( buf, 4 ) != 4 )
+			return false;
+		const quint32 size = qFromBigEndian<quint32>( buf );
+		out.resize( size );
+		return file->read( out.data(), size ) == qint64( size );
+	}
+
+	bool next()
+	{
+		return readBytes( key ) && readBytes( line );
+	}
+};
+
+} // namespace
+
+class ManifestWriter::Private {
+public:
+	Private( const HashAlgorithm *algorithm, Format format )
+		: format( format ), label( algorithm->label.toLatin1() ), name( algorithm->name.toLatin1() )
+	{}
+
+	Format format;
+	QByteArray label;
+	QByteArray name;
+	QFile file;
+	bool toStdout = false;
+	QString base;
+	bool sorted = false;
+	qint64 sortMemory = RUN_SIZE;
+	qint64 syncInterval = SYNC_INTERVAL;
+	qint64 unsynced = 0;
+	QByteArray buffer;
+	QString error;
+
+	quint64 written = 0;
+	quint64 failed = 0;
+
+	// Records of the current sort run: u32 key size, key, u32 line size, line.
+	QByteArray run;
+	std::vector<qsizetype> runOffsets;
+	std::unique_ptr<QTemporaryDir> runDir; // created with the first run
+	std::vector<QString> runs;
+	int runCount = 0;
+
+	bool fail( const QString &message )
+	{
+		if( error.isEmpty() )
+			error = message;
+		return false;
+	}
+
+	void sync()
+	{
+		file.flush();
+#ifdef Q_OS_UNIX
+		// A checkpoint only, pipes and terminals can't be synced.
+		if( !toStdout )
+			::fsync( file.handle() );
+#endif
+		unsynced = 0;
+	}
+
+	void sortRun()
+	{
+		const char *data = run.constData();
+		std::stable_sort( runOffsets.begin(), runOffsets.end(), [data]( qsizetype a, qsizetype b ) {
+			const quint32 aSize = qFromBigEndian<quint32>( data + a );
+			const quint32 bSize = qFromBigEndian<quint32>( data + b );
+			return keyLess( data + a + 4, aSize, data + b + 4, bSize );
+		} );
+	}
+
+	bool createRun( QFile &file )
+	{
+		if( !runDir ) {
+			runDir = std::make_unique<QTemporaryDir>();
+			if( !runDir->isValid() )
+				return fail( runDir->errorString() );
+		}
+		file.setFileName( runDir->filePath( QString::number( runCount++ ) ) );
+		if( !file.open( QIODevice::WriteOnly ) )
+			return fail( file.errorString() );
+		return true;
+	}
+
+	// Merges the runs [first, end) and calls sink( reader ) for every
+	// record in key order, equal keys come out in run order.
+	template<class Sink>
+	bool mergeGroup( std::size_t first, std::size_t end, Sink sink )
+	{
+		std::vector<RunReader> readers;
+		readers.reserve( end - first );
+		for( std::size_t i = first; i < end; i++ ) {
+			RunReader reader { std::make_unique<QFile>( runs[i] ), QByteArray(), QByteArray() };
+			if( !reader.file->open( QIODevice::ReadOnly ) )
+				return fail( reader.file->errorString() );
+			if( reader.next() )
+				readers.push_back( std::move( reader ) );
+		}
+
+		auto greater = [&readers]( int a, int b ) {
+			const QByteArray &ka = readers[a].key;
+			const QByteArray &kb = readers[b].key;
+			if( keyLess( kb.constData(), quint32( kb.size() ), ka.constData(), quint32( ka.size() ) ) )
+				return true;
+			if( keyLess( ka.constData(), quint32( ka.size() ), kb.constData(), quint32( kb.size() ) ) )
+				return false;
+			return a > b;
+		};
+		std::priority_queue<int, std::vector<int>, decltype( greater )> heap( greater );
+		for( int i = 0; i < int( readers.size() ); i++ )
+			heap.push( i );
+
+		while( !heap.empty() ) {
+			const int i = heap.top();
+			heap.pop();
+			if( !sink( readers[i] ) )
+				return false;
+			if( readers[i].next() )
+				heap.push( i );
+		}
+		return true;
+	}
+
+	// Calls sink( line, size ) for every record in run order.
+	template<class Sink>
+	void forEachLine( Sink sink ) const
+	{
+		const char *data = run.constData();
+		for( qsizetype offset : runOffsets ) {
+			const quint32 keySize = qFromBigEndian<quint32>( data + offset );
+			const char *line = data + offset + 4 + keySize;
+			sink( line + 4, qFromBigEndian<quint32>( line ) );
+		}
+	}
+};
+
+ManifestWriter::ManifestWriter( const HashAlgorithm *algorithm, Format format )
+	: d( new ManifestWriter::Private( algorithm ? algorithm : HashAlgorithm::defaultAlgorithm(), format ) )
+{
+}
+
+ManifestWriter::~ManifestWriter()
+{
+	if( d->file.isOpen() )
+		close();
+	delete d;
+}
+
+bool ManifestWriter::open( const QString &fileName )
+{
+	// The writer buffers on its own.
+	d->toStdout = fileName == "-";
+	bool ok = false;
+	if( d->toStdout ) {
+		ok = d->file.open( stdout, QIODevice::WriteOnly | QIODevice::Unbuffered );
+	} else {
+		d->file.setFileName( fileName );
+		ok = d->file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered );
+	}
+	if( !ok )
+		return d->fail( d->file.errorString() );
+
+	d->buffer.reserve( WRITE_SIZE + 64 * 1024 );
+	d->written = d->failed = 0;
+	d->unsynced = 0;
+	return true;
+}
+
+void ManifestWriter::setBaseDirectory( const QDir &dir )
+{
+	d->base = dir.absolutePath();
+	if( !d->base.endsWith( '/' ) )
+		d->base += '/';
+}
+
+void ManifestWriter::setSorted( bool sorted )
+{
+	d->sorted = sorted;
+}
+
+void ManifestWriter::setSortMemory( qint64 bytes )
+{
+	d->sortMemory = bytes;
+}
+
+void ManifestWriter::setSyncInterval( qint64 bytes )
+{
+	d->syncInterval = bytes;
+}
+
+quint64 ManifestWriter::writtenCount() const
+{
+	return d->written;
+}
+
+quint64 ManifestWriter::failedCount() const
+{
+	return d->failed;
+}
+
+QString ManifestWriter::errorString() const
+{
+	return d->error;
+}
+
+bool ManifestWriter::parseFormat( const QString &name, Format *format )
+{
+	const QString key = name.toLower();
+	if( key == "coreutils" || key == "gnu" )
+		*format = CoreutilsFormat;
+	else if( key == "bsd" || key == "tag" )
+		*format = BsdFormat;
+	else if( key == "jsonl" || key == "json" )
+		*format = JsonLinesFormat;
+	else
+		return false;
+	return true;
+}
+
+void ManifestWriter::appendHex( QByteArray &out, const char *data, qsizetype size )
+{
+	const qsizetype start = out.size();
+	out.resize( start + 2 * size );
+	char *dst = out.data() + start;
+	for( qsizetype i = 0; i < size; i++ )
+		std::memcpy( dst + 2 * i, HEX.pairs + 2 * uchar( data[i] ), 2 );
+}
+
+void ManifestWriter::format( QByteArray &out, const QByteArray &path, const HashResult &result ) const
+{
+	switch( d->format ) {
+	case CoreutilsFormat: {
+		const bool escape = needsEscape( path );
+		if( escape )
+			out += '\\';
+		appendHex( out, result.digest.constData(), result.digest.size() );
+		out += "  ";
+		if( escape )
+			appendEscaped( out, path );
+		else
+			out += path;
+		out += '\n';
+		break;
+	}
+	case BsdFormat: {
+		const bool escape = needsEscape( path );
+		if( escape )
+			out += '\\';
+		out += d->label;
+		out += " (";
+		if( escape )
+			appendEscaped( out, path );
+		else
+			out += path;
+		out += ") = ";
+		appendHex( out, result.digest.constData(), result.digest.size() );
+		out += '\n';
+		break;
+	}
+	case JsonLinesFormat:
+		out += "{\"path\":";
+		appendJsonString( out, path );
+		out += ",\"size\":";
+		out += QByteArray::number( result.size );
+		out += ",\"algorithm\":\"";
+		out += d->name;
+		out += "\",\"digest\":";
+		if( result.digest.isEmpty() ) {
+			out += "null";
+		} else {
+			out += '"';
+			appendHex( out, result.digest.constData(), result.digest.size() );
+			out += '"';
+		}
+		out += "}\n";
+		break;
+	}
+}
+
+bool ManifestWriter::write( const HashResult &result )
+{
+	if( result.digest.isEmpty() ) {
+		d->failed++;
+		if( d->format != JsonLinesFormat )
+			return true;
+	}
+	d->written++;
+
+	QString path = result.path;
+	if( !d->base.isEmpty() && path.startsWith( d->base ) )
+		path.remove( 0, d->base.size() );
+	const QByteArray utf8 = path.toUtf8();
+
+	if( !d->sorted ) {
+		format( d->buffer, utf8, result );
+		return flush( false );
+	}
+
+	// The key is kept next to the formatted line for sorting and merging.
+	d->runOffsets.push_back( d->run.size() );
+	appendU32( d->run, quint32( utf8.size() ) );
+	d->run += utf8;
+	const qsizetype lineStart = d->run.size();
+	appendU32( d->run, 0 );
+	format( d->run, utf8, result );
+	qToBigEndian<quint32>( quint32( d->run.size() - lineStart - 4 ), d->run.data() + lineStart );
+
+	if( d->run.size() >= d->sortMemory )
+		return spillRun();
+	return true;
+}
+
+bool ManifestWriter::write( const QVector<HashResult> &results )
+{
+	for( const HashResult &result : results ) {
+		if( !write( result ) )
+			return false;
+	}
+	return true;
+}
+
+bool ManifestWriter::flush( bool force )
+{
+	if( d->buffer.isEmpty() || (!force && d->buffer.size() < WRITE_SIZE) )
+		return true;
+
+	const qint64 size = d->buffer.size();
+	if( d->file.write( d->buffer ) != size )
+		return d->fail( d->file.errorString() );
+	d->buffer.resize( 0 );
+
+	d->unsynced += size;
+	if( d->syncInterval > 0 && d->unsynced >= d->syncInterval )
+		d->sync();
+	return true;
+}
+
+bool ManifestWriter::spillRun()
+{
+	if( d->runOffsets.empty() )
+		return true;
+	d->sortRun();
+
+	QFile file;
+	if( !d->createRun( file ) )
+		return false;
+
+	// Written in blocks of the output buffer size.
+	QByteArray block;
+	block.reserve( WRITE_SIZE + 64 * 1024 );
+	const char *data = d->run.constData();
+	for( qsizetype offset : d->runOffsets ) {
+		const quint32 keySize = qFromBigEndian<quint32>( data + offset );
+		const quint32 lineSize = qFromBigEndian<quint32>( data + offset + 4 + keySize );
+		block.append( data + offset, 8 + keySize + lineSize );
+		if( block.size() >= WRITE_SIZE ) {
+			if( file.write( block ) != block.size() )
+				return d->fail( file.errorString() );
+			block.resize( 0 );
+		}
+	}
+	if( file.write( block ) != block.size() || !file.flush() )
+		return d->fail( file.errorString() );
+	// Reopened for merging, so only the runs being merged hold a handle.
+	file.close();
+
+	d->runs.push_back( file.fileName() );
+	d->run.resize( 0 );
+	d->runOffsets.clear();
+	return true;
+}
+
+bool ManifestWriter::mergeRuns()
+{
+	// Merge groups of runs into longer runs until the rest fits into one
+	// pass. Groups are consecutive, so equal keys keep their order.
+	while( d->runs.size() > MAX_MERGE_RUNS ) {
+		std::vector<QString> merged;
+		for( std::size_t first = 0; first < d->runs.size(); first += MAX_MERGE_RUNS ) {
+			const std::size_t end = qMin<std::size_t>( first + MAX_MERGE_RUNS, d->runs.size() );
+			QFile file;
+			if( !d->createRun( file ) )
+				return false;
+
+			QByteArray block;
+			block.reserve( WRITE_SIZE + 64 * 1024 );
+			const bool ok = d->mergeGroup( first, end, [this, &file, &block]( const RunReader &reader ) {
+				appendU32( block, quint32( reader.key.size() ) );
+				block += reader.key;
+				appendU32( block, quint32( reader.line.size() ) );
+				block += reader.line;
+				if( block.size() < WRITE_SIZE )
+					return true;
+				const bool written = file.write( block ) == block.size();
+				block.resize( 0 );
+				return written || d->fail( file.errorString() );
+			} );
+			if( !ok )
+				return false;
+			if( file.write( block ) != block.size() || !file.flush() )
+				return d->fail( file.errorString() );
+			file.close();
+
+			for( std::size_t i = first; i < end; i++ )
+				QFile::remove( d->runs[i] );
+			merged.push_back( file.fileName() );
+		}
+		d->runs.swap( merged );
+	}
+
+	const bool ok = d->mergeGroup( 0, d->runs.size(), [this]( const RunReader &reader ) {
+		d->buffer += reader.line;
+		return flush( false );
+	} );
+	d->runs.clear();
+	d->runDir.reset();
+	return ok;
+}
+
+bool ManifestWriter::close()
+{
+	bool ok = d->error.isEmpty();
+	if( ok && d->sorted ) {
+		if( d->runs.empty() ) {
+			// Everything fit into one run, no temporary files needed.
+			d->sortRun();
+			d->forEachLine( [this, &ok]( const char *line, quint32 size ) {
+				d->buffer.append( line, size );
+				ok = ok && flush( false );
+			} );
+			d->run.resize( 0 );
+			d->runOffsets.clear();
+		} else {
+			ok = spillRun() && mergeRuns();
+		}
+	}
+	ok = ok && flush( true );
+	if( ok )
+		d->sync();
+	d->file.close();
+	d->runs.clear();
+	d->runDir.reset();
+	return ok && d->error.isEmpty();
+}
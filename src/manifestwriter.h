@@ -0,0 +1,71 @@
+#pragma once
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QDir>
+#include <QtCore/QVector>
+
+#include "resultstore.h"
+
+struct HashAlgorithm;
+
+/**
+ * Streams batch results into a checksum manifest.
+ *
+ * Lines are formatted into a large output buffer and written in big
+ * blocks, with an fsync every syncInterval bytes, so a crash loses at
+ * most the last checkpoint. Files that could not be read are left out of
+ * the coreutils and BSD formats and written with a null digest to JSON
+ * Lines.
+ *
+ * Sorted output is produced without holding all results: formatted lines
+ * are sorted in runs of limited size, spilled to temporary files and
+ * merged on close(). Runs are closed until they are merged, more than 64
+ * of them are merged in several passes.
+ */
+class ManifestWriter
+{
+public:
+	enum Format {
+		CoreutilsFormat, // "<hex>  <path>", as written by sha256sum
+		BsdFormat,       // "SHA256 (<path>) = <hex>", as written by sha256sum --tag
+		JsonLinesFormat  // one JSON object per file
+	};
+
+	ManifestWriter( const HashAlgorithm *algorithm, Format format );
+	~ManifestWriter();
+
+	// "-" writes to the standard output.
+	bool open( const QString &fileName );
+
+	// Paths below the base directory are written relative to it.
+	void setBaseDirectory( const QDir &dir );
+	// Sorts the lines by the byte order of their UTF-8 paths.
+	void setSorted( bool sorted );
+	// Size of the sort runs kept in memory before spilling to disk.
+	void setSortMemory( qint64 bytes );
+	void setSyncInterval( qint64 bytes );
+
+	bool write( const HashResult &result );
+	bool write( const QVector<HashResult> &results );
+	bool close();
+
+	quint64 writtenCount() const;
+	quint64 failedCount() const;
+	QString errorString() const;
+
+	static bool parseFormat( const QString &name, Format *format );
+
+	// Lower case hex of the data, two characters per byte.
+	static void appendHex( QByteArray &out, const char *data, qsizetype size );
+
+private:
+	Q_DISABLE_COPY( ManifestWriter )
+
+	class Private;
+	Private *d;
+
+	void format( QByteArray &out, const QByteArray &path, const HashResult &result ) const;
+	bool flush( bool force );
+	bool spillRun();
+	bool mergeRuns();
+};
@@ -0,0 +1,348 @@
+#include "resultmodel.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QTimer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QReadLocker>
+#include <QtGui/QFontDatabase>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#define FLUSH_INTERVAL 100
+#define RESORT_INTERVAL 2000
+
+namespace {
+
+int compareBytes( QByteArrayView a, QByteArrayView b )
+{
+	const qsizetype len = qMin( a.size(), b.size() );
+	const int c = len ? std::memcmp( a.data(), b.data(), len ) : 0;
+	if( c )
+		return c;
+	return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+// Sorts store rows by the given column. Ties are broken by row number,
+// so the result is deterministic.
+void sortRows( const ResultStore &store, int column, Qt::SortOrder order, QVector<quint32> &rows )
+{
+	// Rank directories once, so rows compare by integer instead of string.
+	QVector<quint32> dirRank;
+	if( column == ResultModel::DirectoryColumn ) {
+		QVector<quint32> ids( store.directoryCount() );
+		for( quint32 i = 0; i < quint32( ids.size() ); i++ )
+			ids[i] = i;
+		std::sort( ids.begin(), ids.end(), [&store]( quint32 a, quint32 b ) {
+			return store.directoryById( a ) < store.directoryById( b );
+		} );
+		dirRank.resize( ids.size() );
+		for( quint32 i = 0; i < quint32( ids.size() ); i++ )
+			dirRank[ids[i]] = i;
+	}
+
+	auto less = [&]( quint32 a, quint32 b ) -> bool {
+		int c = 0;
+		switch( column ) {
+		case ResultModel::DirectoryColumn:
+			c = int( dirRank[store.directoryId( a )] ) - int( dirRank[store.directoryId( b )] );
+			if( !c )
+				c = compareBytes( store.fileNameUtf8( a ), store.fileNameUtf8( b ) );
+			break;
+		case ResultModel::SizeColumn:
+			c = store.size( a ) < store.size( b ) ? -1 : (store.size( a ) > store.size( b ) ? 1 : 0);
+			break;
+		case ResultModel::DigestColumn:
+			c = compareBytes( store.digest( a ), store.digest( b ) );
+			break;
+		default:
+			c = compareBytes( store.fileNameUtf8( a ), store.fileNameUtf8( b ) );
+			break;
+		}
+		return c ? c < 0 : a < b;
+	};
+
+	std::sort( rows.begin(), rows.end(), less );
+	if( order == Qt::DescendingOrder )
+		std::reverse( rows.begin(), rows.end() );
+}
+
+} // namespace
+
+class ResultModel::Private {
+public:
+	Private()
+	{
+		flushTimer.setSingleShot( true );
+		flushTimer.setInterval( FLUSH_INTERVAL );
+		resortTimer.setSingleShot( true );
+		resortTimer.setInterval( RESORT_INTERVAL );
+		// One rebuild at a time, newer requests supersede older ones.
+		pool.setMaxThreadCount( 1 );
+	}
+
+	ResultStore store;
+	QVector<HashResult> pending;
+	QTimer flushTimer;
+	QTimer resortTimer;
+
+	// Row permutation, only used while filtered or sorted.
+	bool ordered = false;
+	QVector<quint32> order;
+
+	QString filter;
+	int sortColumn = -1;
+	Qt::SortOrder sortOrder = Qt::AscendingOrder;
+
+	QThreadPool pool;
+	std::atomic<quint64> generation { 0 };
+};
+
+ResultModel::ResultModel( QObject *parent )
+	: QAbstractTableModel( parent ), d( new ResultModel::Private() )
+{
+	qRegisterMetaType<HashResult>();
+	qRegisterMetaType<QVector<HashResult>>();
+
+	connect( &d->flushTimer, SIGNAL( timeout() ), this, SLOT( flushPending() ) );
+	connect( &d->resortTimer, &QTimer::timeout, this, [this]() { rebuildOrder(); } );
+}
+
+ResultModel::~ResultModel()
+{
+	// Let a running rebuild notice it is outdated, then wait for it.
+	d->generation++;
+	d->pool.waitForDone();
+	delete d;
+}
+
+const ResultStore & ResultModel::store() const
+{
+	return d->store;
+}
+
+void ResultModel::setDigestSize( int size )
+{
+	d->store.setDigestSize( size );
+}
+
+quint32 ResultModel::storeRow( int row ) const
+{
+	return d->ordered ? d->order.at( row ) : quint32( row );
+}
+
+int ResultModel::rowCount( const QModelIndex &parent ) const
+{
+	if( parent.isValid() )
+		return 0;
+	return d->ordered ? int( d->order.size() ) : int( d->store.count() );
+}
+
+int ResultModel::columnCount( const QModelIndex &parent ) const
+{
+	return parent.isValid() ? 0 : ColumnCount;
+}
+
+QVariant ResultModel::data( const QModelIndex &index, int role ) const
+{
+	if( !index.isValid() )
+		return QVariant();
+
+	// Everything is formatted on demand, only visible rows are ever touched.
+	const quint32 row = storeRow( index.row() );
+	switch( role ) {
+	case Qt::DisplayRole:
+		switch( index.column() ) {
+		case NameColumn:
+			return d->store.fileName( row );
+		case DirectoryColumn:
+			return QDir::toNativeSeparators( d->store.directory( row ) );
+		case SizeColumn:
+			return d->store.size( row );
+		case DigestColumn:
+			return d->store.failed( row ) ? tr( "read error" ) : d->store.digestHex( row );
+		}
+		break;
+	case Qt::ToolTipRole:
+		return QDir::toNativeSeparators( d->store.path( row ) );
+	case Qt::TextAlignmentRole:
+		if( index.column() == SizeColumn )
+			return int( Qt::AlignRight | Qt::AlignVCenter );
+		break;
+	case Qt::FontRole:
+		if( index.column() == DigestColumn )
+			return QFontDatabase::systemFont( QFontDatabase::FixedFont );
+		break;
+	}
+	return QVariant();
+}
+
+QVariant ResultModel::headerData( int section, Qt::Orientation orientation, int role ) const
+{
+	if( orientation != Qt::Horizontal || role != Qt::DisplayRole )
+		return QAbstractTableModel::headerData( section, orientation, role );
+
+	switch( section ) {
+	case NameColumn:
+		return tr( "Name" );
+	case DirectoryColumn:
+		return tr( "Directory" );
+	case SizeColumn:
+		return tr( "Size" );
+	case DigestColumn:
+		return tr( "Digest" );
+	}
+	return QVariant();
+}
+
+void ResultModel::sort( int column, Qt::SortOrder order )
+{
+	d->sortColumn = column;
+	d->sortOrder = order;
+	rebuildOrder();
+}
+
+void ResultModel::setFilter( const QString &filter )
+{
+	if( filter == d->filter )
+		return;
+	d->filter = filter;
+	rebuildOrder();
+}
+
+void ResultModel::clear()
+{
+	d->generation++;
+	d->pool.waitForDone();
+
+	beginResetModel();
+	d->pending.clear();
+	d->flushTimer.stop();
+	d->resortTimer.stop();
+	d->store.clear();
+	d->order.clear();
+	d->ordered = false;
+	endResetModel();
+}
+
+void ResultModel::appendResults( const QVector<HashResult> &results )
+{
+	d->pending += results;
+	if( !d->flushTimer.isActive() )
+		d->flushTimer.start();
+}
+
+void ResultModel::flushPending()
+{
+	if( d->pending.isEmpty() )
+		return;
+
+	// A rebuild is reading the store, try again on the next tick instead
+	// of blocking the GUI thread.
+	QReadWriteLock *lock = d->store.lock();
+	if( !lock->tryLockForWrite() ) {
+		d->flushTimer.start();
+		return;
+	}
+
+	const quint32 first = d->store.count();
+	const quint32 last = first + quint32( d->pending.size() ) - 1;
+
+	if( !d->ordered ) {
+		beginInsertRows( QModelIndex(), int( first ), int( last ) );
+		for( const HashResult &result : qAsConst( d->pending ) )
+			d->store.append( result );
+		lock->unlock();
+		endInsertRows();
+	} else {
+		for( const HashResult &result : qAsConst( d->pending ) )
+			d->store.append( result );
+		lock->unlock();
+
+		// New rows go to the end of the view until the next resort.
+		QVector<quint32> rows;
+		for( quint32 row = first; row <= last; row++ ) {
+			if( matchesFilter( row ) )
+				rows.append( row );
+		}
+		if( !rows.isEmpty() ) {
+			const int pos = int( d->order.size() );
+			beginInsertRows( QModelIndex(), pos, pos + int( rows.size() ) - 1 );
+			d->order += rows;
+			endInsertRows();
+		}
+		if( d->sortColumn >= 0 && !d->resortTimer.isActive() )
+			d->resortTimer.start();
+	}
+	d->pending.clear();
+}
+
+bool ResultModel::matchesFilter( quint32 row ) const
+{
+	return d->filter.isEmpty() || d->store.path( row ).contains( d->filter, Qt::CaseInsensitive );
+}
+
+void ResultModel::rebuildOrder()
+{
+	const quint64 generation = ++d->generation;
+	d->resortTimer.stop();
+
+	if( d->filter.isEmpty() && d->sortColumn < 0 ) {
+		applyOrder( generation, d->store.count(), QVector<quint32>() );
+		return;
+	}
+
+	emit busyChanged( true );
+
+	const ResultStore *store = &d->store;
+	std::atomic<quint64> *current = &d->generation;
+	const QString filter = d->filter;
+	const int column = d->sortColumn;
+	const Qt::SortOrder order = d->sortOrder;
+
+	d->pool.start( [=]() {
+		QVector<quint32> rows;
+		quint32 count = 0;
+		{
+			QReadLocker locker( store->lock() );
+			count = store->count();
+			rows.reserve( count );
+			for( quint32 row = 0; row < count; row++ ) {
+				if( (row & 0xffff) == 0 && *current != generation )
+					return;
+				if( filter.isEmpty() || store->path( row ).contains( filter, Qt::CaseInsensitive ) )
+					rows.append( row );
+			}
+			if( column >= 0 )
+				sortRows( *store, column, order, rows );
+		}
+		if( *current != generation )
+			return;
+		QMetaObject::invokeMethod( this, [this, generation, count, rows]() {
+			applyOrder( generation, count, rows );
+		}, Qt::QueuedConnection );
+	} );
+}
+
+void ResultModel::applyOrder( quint64 generation, quint32 snapshot, const QVector<quint32> &order )
+{
+	if( generation != d->generation )
+		return;
+
+	const bool ordered = !d->filter.isEmpty() || d->sortColumn >= 0;
+
+	beginResetModel();
+	d->ordered = ordered;
+	d->order = order;
+	if( ordered ) {
+		// Rows appended after the rebuild took its snapshot.
+		for( quint32 row = snapshot; row < d->store.count(); row++ ) {
+			if( matchesFilter( row ) )
+				d->order.append( row );
+		}
+	}
+	endResetModel();
+
+	emit busyChanged( false );
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <QtCore/QAbstractTableModel>
+#include <QtCore/QVector>
+
+#include "resultstore.h"
+
+/**
+ * Lazy table model on top of a ResultStore.
+ *
+ * Results arriving from worker threads are buffered and inserted in one
+ * batch per timer tick. Sorting and filtering build a row permutation on
+ * a background thread, the view switches to it once it is done.
+ */
+class ResultModel : public QAbstractTableModel
+{
+	Q_OBJECT
+
+public:
+	enum Column {
+		NameColumn,
+		DirectoryColumn,
+		SizeColumn,
+		DigestColumn,
+		ColumnCount
+	};
+
+	ResultModel( QObject *parent = nullptr );
+	~ResultModel();
+
+	const ResultStore & store() const;
+	void setDigestSize( int size );
+
+	// Maps a view row to the row in the store.
+	quint32 storeRow( int row ) const;
+
+	int rowCount( const QModelIndex &parent = QModelIndex() ) const override;
+	int columnCount( const QModelIndex &parent = QModelIndex() ) const override;
+	QVariant data( const QModelIndex &index, int role = Qt::DisplayRole ) const override;
+	QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const override;
+	void sort( int column, Qt::SortOrder order = Qt::AscendingOrder ) override;
+
+public slots:
+	void appendResults( const QVector<HashResult> &results );
+	void setFilter( const QString &filter );
+	void clear();
+
+private slots:
+	void flushPending();
+
+private:
+	class Private;
+	Private *d;
+
+	void rebuildOrder();
+	void applyOrder( quint64 generation, quint32 snapshot, const QVector<quint32> &order );
+	bool matchesFilter( quint32 row ) const;
+
+signals:
+	void busyChanged( bool );
+};
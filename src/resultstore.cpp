@@ -0,0 +1,120 @@
+#include "resultstore.h"
+
+#include <cstring>
+
+ResultStore::ResultStore( int digestSize )
+	: digestLength( digestSize ), lastDirId( 0 )
+{
+	nameOffsets.append( 0 );
+}
+
+void ResultStore::setDigestSize( int size )
+{
+	// The record width can only change while the store is empty.
+	if( count() == 0 )
+		digestLength = size;
+}
+
+void ResultStore::reserve( quint32 rows )
+{
+	nameOffsets.reserve( rows + 1 );
+	dirColumn.reserve( rows );
+	sizes.reserve( rows );
+	digests.reserve( qsizetype( rows ) * digestLength );
+}
+
+void ResultStore::append( const HashResult &result )
+{
+	// Split the path into interned directory and file name.
+	const qsizetype slash = result.path.lastIndexOf( QLatin1Char( '/' ) );
+	const QString dir = slash >= 0 ? result.path.left( slash ) : QString();
+	const QString name = slash >= 0 ? result.path.mid( slash + 1 ) : result.path;
+
+	// Results of one directory usually arrive together, try the last one first.
+	quint32 dirId = lastDirId;
+	if( dirs.isEmpty() || dirs.at( dirId ) != dir ) {
+		auto it = dirIds.constFind( dir );
+		if( it == dirIds.constEnd() ) {
+			dirId = quint32( dirs.size() );
+			dirs.append( dir );
+			dirIds.insert( dir, dirId );
+		} else {
+			dirId = it.value();
+		}
+		lastDirId = dirId;
+	}
+
+	names.append( name.toUtf8() );
+	nameOffsets.append( quint64( names.size() ) );
+	dirColumn.append( dirId );
+
+	// Failed rows keep a zeroed digest record to stay fixed-size.
+	const bool ok = result.digest.size() == digestLength;
+	sizes.append( (result.size & SIZE_MASK) | (ok ? 0 : FAILED_FLAG) );
+	if( ok )
+		digests.append( result.digest );
+	else
+		digests.append( digestLength, '\0' );
+}
+
+void ResultStore::clear()
+{
+	dirIds.clear();
+	dirs.clear();
+	lastDirId = 0;
+	names.clear();
+	nameOffsets.clear();
+	nameOffsets.append( 0 );
+	dirColumn.clear();
+	sizes.clear();
+	digests.clear();
+}
+
+QByteArrayView ResultStore::fileNameUtf8( quint32 row ) const
+{
+	const quint64 begin = nameOffsets.at( row );
+	const quint64 end = nameOffsets.at( row + 1 );
+	return QByteArrayView( names.constData() + begin, qsizetype( end - begin ) );
+}
+
+QString ResultStore::fileName( quint32 row ) const
+{
+	return QString::fromUtf8( fileNameUtf8( row ) );
+}
+
+QString ResultStore::directory( quint32 row ) const
+{
+	return dirs.at( dirColumn.at( row ) );
+}
+
+QString ResultStore::path( quint32 row ) const
+{
+	const QString &dir = dirs.at( dirColumn.at( row ) );
+	if( dir.isEmpty() )
+		return fileName( row );
+	return dir + QLatin1Char( '/' ) + fileName( row );
+}
+
+QByteArrayView ResultStore::digest( quint32 row ) const
+{
+	if( failed( row ) )
+		return QByteArrayView();
+	return QByteArrayView( digests.constData() + qsizetype( row ) * digestLength, digestLength );
+}
+
+QString ResultStore::digestHex( quint32 row ) const
+{
+	return QString::fromLatin1( digest( row ).toByteArray().toHex() );
+}
+
+quint64 ResultStore::memoryUsage() const
+{
+	quint64 bytes = names.capacity() + digests.capacity();
+	bytes += nameOffsets.capacity() * sizeof( quint64 );
+	bytes += dirColumn.capacity() * sizeof( quint32 );
+	bytes += sizes.capacity() * sizeof( qint64 );
+	for( const QString &dir : dirs )
+		bytes += dir.capacity() * sizeof( QChar ) + sizeof( QString );
+	bytes += dirIds.capacity() * (sizeof( QString ) + sizeof( quint32 ));
+	return bytes;
+}
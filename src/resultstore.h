@@ -0,0 +1,80 @@
+#pragma once
+#include <QtCore/QString>
+#include <QtCore/QByteArray>
+#include <QtCore/QByteArrayView>
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+#include <QtCore/QMetaType>
+#include <QtCore/QReadWriteLock>
+
+/**
+ * Result of hashing a single file, as delivered by the workers.
+ * An empty digest marks a file that could not be read.
+ */
+struct HashResult
+{
+	QString path;
+	qint64 size = 0;
+	QByteArray digest;
+};
+Q_DECLARE_METATYPE( HashResult )
+Q_DECLARE_METATYPE( QVector<HashResult> )
+
+/**
+ * Append-only columnar storage for batch results.
+ *
+ * Directories are interned, file names live in one UTF-8 pool and digests
+ * are kept as fixed-size binary records, so a row costs the length of its
+ * file name plus about 50 bytes for a SHA256 digest.
+ *
+ * The store does no locking on its own. Writers hold lock() for writing,
+ * readers on other threads hold it for reading.
+ */
+class ResultStore
+{
+public:
+	explicit ResultStore( int digestSize = 0 );
+
+	void setDigestSize( int size );
+	int digestSize() const { return digestLength; }
+
+	quint32 count() const { return quint32( sizes.size() ); }
+	void reserve( quint32 rows );
+	void append( const HashResult &result );
+	void clear();
+
+	QString fileName( quint32 row ) const;
+	QString directory( quint32 row ) const;
+	QString path( quint32 row ) const;
+	qint64 size( quint32 row ) const { return sizes.at( row ) & SIZE_MASK; }
+	bool failed( quint32 row ) const { return sizes.at( row ) & FAILED_FLAG; }
+	QByteArrayView digest( quint32 row ) const;
+	QString digestHex( quint32 row ) const;
+
+	// Raw access for sorting and filtering without allocations.
+	QByteArrayView fileNameUtf8( quint32 row ) const;
+	quint32 directoryId( quint32 row ) const { return dirColumn.at( row ); }
+	quint32 directoryCount() const { return quint32( dirs.size() ); }
+	const QString & directoryById( quint32 id ) const { return dirs.at( id ); }
+
+	quint64 memoryUsage() const;
+	QReadWriteLock * lock() const { return &rwLock; }
+
+private:
+	static const qint64 FAILED_FLAG = qint64( 1 ) << 62;
+	static const qint64 SIZE_MASK = FAILED_FLAG - 1;
+
+	int digestLength;
+
+	QHash<QString, quint32> dirIds;
+	QVector<QString> dirs;
+	quint32 lastDirId;
+
+	QByteArray names;
+	QVector<quint64> nameOffsets; // one more entry than rows
+	QVector<quint32> dirColumn;
+	QVector<qint64> sizes;
+	QByteArray digests;
+
+	mutable QReadWriteLock rwLock;
+};
@@ -0,0 +1,146 @@
+#include "throttle.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QMutexLocker>
+
+#include "trace.h"
+
+#if defined( Q_OS_LINUX )
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined( Q_OS_WIN )
+#include <windows.h>
+#endif
+
+#define BURST_SECONDS 0.25
+#define MAX_SLEEP 50
+#define RATE_WINDOW 1000
+
+#if defined( Q_OS_LINUX )
+// From linux/ioprio.h, which is not shipped by every libc.
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_PRIO_VALUE( cls, data ) (((cls) << IOPRIO_CLASS_SHIFT) | (data))
+#endif
+
+Throttle::Throttle()
+	: rate( 0 ), tokens( 0 ), lastRefill( 0 ), windowStart( 0 ), windowBytes( 0 ), lastRate( 0 )
+{
+	clock.start();
+}
+
+void Throttle::setLimit( double mbps )
+{
+	QMutexLocker locker( &mutex );
+	refill( clock.nsecsElapsed() );
+	rate = mbps > 0 ? mbps * 1024 * 1024 : 0;
+	// Forget old debt, the new limit applies from now on.
+	tokens = 0;
+}
+
+double Throttle::limit() const
+{
+	QMutexLocker locker( &mutex );
+	return rate / (1024 * 1024);
+}
+
+double Throttle::effectiveRate() const
+{
+	QMutexLocker locker( &mutex );
+	// Nothing got through for a while, report what the open window saw.
+	const qint64 elapsed = clock.nsecsElapsed() - windowStart;
+	if( elapsed >= 2 * qint64( RATE_WINDOW ) * 1000000 )
+		return windowBytes / (elapsed / 1e9) / (1024 * 1024);
+	return lastRate;
+}
+
+void Throttle::refill( qint64 now )
+{
+	if( rate > 0 ) {
+		tokens += (now - lastRefill) / 1e9 * rate;
+		tokens = qMin( tokens, rate * BURST_SECONDS );
+	}
+	lastRefill = now;
+}
+
+void Throttle::acquire( quint64 bytes, const std::atomic<bool> *stop )
+{
+	QMutexLocker locker( &mutex );
+	const qint64 now = clock.nsecsElapsed();
+	refill( now );
+
+	// Measure what actually got through.
+	windowBytes += bytes;
+	if( now - windowStart >= qint64( RATE_WINDOW ) * 1000000 ) {
+		lastRate = windowBytes / ((now - windowStart) / 1e9) / (1024 * 1024);
+		windowStart = now;
+		windowBytes = 0;
+	}
+
+	if( rate <= 0 )
+		return;
+	tokens -= bytes;
+
+	// Sleep off the debt in short steps, so limit changes and stop
+	// requests are noticed quickly.
+	quint64 waited = 0;
+	while( rate > 0 && tokens < 0 && !(stop && *stop) ) {
+		if( !waited )
+			waited = Trace::timestamp();
+		const unsigned long ms = (unsigned long)qBound( 1.0, -tokens / rate * 1000, double( MAX_SLEEP ) );
+		locker.unlock();
+		QThread::msleep( ms );
+		locker.relock();
+		refill( clock.nsecsElapsed() );
+	}
+	if( waited )
+		Trace::record( "throttle", waited );
+}
+
+bool Throttle::setCurrentThreadPriority( Priority priority )
+{
+	// Pool threads call this for every task, only act on changes. Refused
+	// changes are retried with the next call.
+	thread_local Priority current = NormalPriority;
+	if( priority == current )
+		return true;
+
+	bool ok = true;
+#if defined( Q_OS_LINUX )
+	// Nice value and I/O priority are per thread on Linux.
+	const pid_t tid = pid_t( syscall( SYS_gettid ) );
+	int nice = 0;
+	int ioprio = IOPRIO_PRIO_VALUE( IOPRIO_CLASS_BE, 4 );
+	if( priority == BackgroundPriority ) {
+		nice = 19;
+		ioprio = IOPRIO_PRIO_VALUE( IOPRIO_CLASS_BE, 7 );
+	} else if( priority == IdlePriority ) {
+		nice = 19;
+		ioprio = IOPRIO_PRIO_VALUE( IOPRIO_CLASS_IDLE, 0 );
+	}
+	// Lowering the nice value again needs CAP_SYS_NICE or RLIMIT_NICE.
+	ok = setpriority( PRIO_PROCESS, id_t( tid ), nice ) == 0;
+	ok = syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio ) == 0 && ok;
+#elif defined( Q_OS_WIN )
+	// Background mode lowers both CPU and I/O priority.
+	if( priority == NormalPriority )
+		ok = SetThreadPriority( GetCurrentThread(), THREAD_MODE_BACKGROUND_END ) != 0;
+	else
+		ok = SetThreadPriority( GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN ) != 0;
+#else
+	QThread::currentThread()->setPriority( priority == NormalPriority
+			? QThread::NormalPriority : QThread::LowestPriority );
+#endif
+
+	if( ok ) {
+		current = priority;
+	} else {
+		static std::atomic<bool> warned { false };
+		if( !warned.exchange( true ) )
+			qWarning( "Cannot change the priority of worker threads, they may keep running with the previous priority" );
+	}
+	return ok;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <QtCore/QMutex>
+#include <QtCore/QElapsedTimer>
+
+#include <atomic>
+
+/**
+ * Token bucket limiting the bandwidth of hashing workers. The limit can be
+ * changed at any time from any thread, waiting workers pick it up within
+ * a few milliseconds. The bucket also measures the effective rate.
+ */
+class Throttle
+{
+public:
+	enum Priority {
+		NormalPriority,
+		BackgroundPriority, // lowest CPU priority, lowest best-effort I/O priority
+		IdlePriority        // lowest CPU priority, I/O only when the disk is idle
+	};
+
+	Throttle();
+
+	// Limit in MB/s, 0 disables the limit.
+	void setLimit( double mbps );
+	double limit() const;
+
+	// Accounts for bytes processed by the caller and blocks as long as the
+	// bucket is in debt. Returns early once stop is set.
+	void acquire( quint64 bytes, const std::atomic<bool> *stop = nullptr );
+
+	// Effective rate in MB/s, measured over roughly the last second.
+	double effectiveRate() const;
+
+	// Changes CPU and I/O priority of the calling thread. Threads start out
+	// with NormalPriority, repeated calls with the same value are cheap.
+	// Returns false and warns once if the system refused the change. On
+	// Linux, unprivileged users can't raise the nice value again, threads
+	// that ran in the background stay at low CPU priority then.
+	static bool setCurrentThreadPriority( Priority priority );
+
+private:
+	mutable QMutex mutex;
+	QElapsedTimer clock;
+	double rate;    // bytes per second, 0 if unlimited
+	double tokens;  // may become negative, that is the debt to wait for
+	qint64 lastRefill;
+
+	qint64 windowStart;
+	quint64 windowBytes;
+	double lastRate;
+
+	void refill( qint64 now );
+};
@@ -0,0 +1,250 @@
+#include "trace.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#define RING_SIZE (64 * 1024) // spans per thread, a power of two
+#define RETIRED_SIZE (16 * RING_SIZE) // spans of exited threads, all together
+#define WRITE_SIZE (1024 * 1024)
+
+namespace {
+
+struct Event
+{
+	const char *name;
+	quint64 start;
+	quint64 end;
+	qint64 arg;
+};
+
+// Written by its thread only, the head is published after each event.
+struct Ring
+{
+	std::atomic<quint64> head { 0 };
+	std::vector<Event> events = std::vector<Event>( RING_SIZE );
+	quint32 tid = 0;
+	QString name;
+	bool active = false;
+};
+
+// Events of a thread that exited, kept under its own id and name.
+struct Retired
+{
+	quint32 tid;
+	QString name;
+	std::vector<Event> events;
+};
+
+struct Registry
+{
+	QMutex mutex;
+	std::vector<std::unique_ptr<Ring>> rings;
+	std::vector<Retired> retired;
+	std::size_t retiredEvents = 0;
+	quint32 nextTid = 0;
+};
+
+Registry& registry()
+{
+	static Registry instance;
+	return instance;
+}
+
+// Rings outlive their threads and are handed to new threads, so pools
+// that come and go don't pile up buffers. The events of the previous
+// thread are moved aside under its id, the new thread gets a new one.
+// Past RETIRED_SIZE the oldest exited threads are dropped entirely.
+struct RingHandle
+{
+	Ring *ring = nullptr;
+
+	~RingHandle()
+	{
+		if( ring ) {
+			QMutexLocker locker( &registry().mutex );
+			ring->active = false;
+		}
+	}
+
+	Ring& get()
+	{
+		if( ring )
+			return *ring;
+
+		Registry &r = registry();
+		QMutexLocker locker( &r.mutex );
+		for( const auto &candidate : r.rings ) {
+			if( !candidate->active ) {
+				ring = candidate.get();
+				break;
+			}
+		}
+		if( ring ) {
+			const quint64 head = ring->head.load( std::memory_order_relaxed );
+			if( head ) {
+				const quint64 first = head > RING_SIZE ? head - RING_SIZE : 0;
+				Retired old { ring->tid, ring->name, {} };
+				old.events.reserve( std::size_t( head - first ) );
+				for( quint64 i = first; i < head; i++ )
+					old.events.push_back( ring->events[i & (RING_SIZE - 1)] );
+				r.retiredEvents += old.events.size();
+				r.retired.push_back( std::move( old ) );
+				std::size_t drop = 0;
+				while( r.retiredEvents > RETIRED_SIZE ) {
+					r.retiredEvents -= r.retired[drop].events.size();
+					drop++;
+				}
+				r.retired.erase( r.retired.begin(), r.retired.begin() + std::ptrdiff_t( drop ) );
+				ring->head.store( 0, std::memory_order_relaxed );
+			}
+		} else {
+			r.rings.push_back( std::make_unique<Ring>() );
+			ring = r.rings.back().get();
+		}
+		ring->tid = ++r.nextTid;
+		ring->active = true;
+		ring->name = QThread::currentThread()->objectName();
+		if( ring->name.isEmpty() )
+			ring->name = QString( "Thread %1" ).arg( ring->tid );
+		return *ring;
+	}
+};
+
+thread_local RingHandle currentRing;
+
+void appendEscaped( QByteArray &out, const QByteArray &str )
+{
+	for( char c : str ) {
+		if( c == '"' || c == '\\' ) {
+			out += '\\';
+			out += c;
+		} else if( uchar( c ) < 0x20 ) {
+			out += ' ';
+		} else {
+			out += c;
+		}
+	}
+}
+
+// Chrome trace timestamps are microseconds.
+QByteArray micros( quint64 ns )
+{
+	return QByteArray::number( ns / 1000 ) + '.' + QByteArray::number( ns % 1000 ).rightJustified( 3, '0' );
+}
+
+} // namespace
+
+void Trace::setEnabled( bool value )
+{
+	enabled.store( value, std::memory_order_relaxed );
+}
+
+quint64 Trace::now()
+{
+	return quint64( std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch() ).count() );
+}
+
+void Trace::record( const char *name, quint64 start, qint64 arg )
+{
+	Ring &ring = currentRing.get();
+	const quint64 head = ring.head.load( std::memory_order_relaxed );
+	ring.events[head & (RING_SIZE - 1)] = Event { name, start, now(), arg };
+	ring.head.store( head + 1, std::memory_order_release );
+}
+
+void Trace::setThreadName( const QString &name )
+{
+	if( !isEnabled() )
+		return;
+	Ring &ring = currentRing.get();
+	QMutexLocker locker( &registry().mutex );
+	ring.name = name;
+}
+
+bool Trace::exportChromeTrace( const QString &fileName )
+{
+	struct Thread {
+		quint32 tid;
+		QString name;
+		std::vector<Event> events;
+	};
+
+	// Copy the rings first. Events a running thread overwrote meanwhile
+	// are dropped by looking at its head again.
+	std::vector<Thread> threads;
+	quint64 origin = ~quint64( 0 );
+	{
+		Registry &r = registry();
+		QMutexLocker locker( &r.mutex );
+		for( const auto &ring : r.rings ) {
+			const quint64 head = ring->head.load( std::memory_order_acquire );
+			const quint64 first = head > RING_SIZE ? head - RING_SIZE : 0;
+			Thread thread { ring->tid, ring->name, {} };
+			thread.events.reserve( std::size_t( head - first ) );
+			for( quint64 i = first; i < head; i++ )
+				thread.events.push_back( ring->events[i & (RING_SIZE - 1)] );
+
+			const quint64 after = ring->head.load( std::memory_order_acquire );
+			if( after >= RING_SIZE && after - RING_SIZE + 1 > first ) {
+				const quint64 lost = qMin( after - RING_SIZE + 1 - first, quint64( thread.events.size() ) );
+				thread.events.erase( thread.events.begin(), thread.events.begin() + std::ptrdiff_t( lost ) );
+			}
+			for( const Event &e : thread.events )
+				origin = qMin( origin, e.start );
+			threads.push_back( std::move( thread ) );
+		}
+		for( const Retired &old : r.retired ) {
+			for( const Event &e : old.events )
+				origin = qMin( origin, e.start );
+			threads.push_back( Thread { old.tid, old.name, old.events } );
+		}
+	}
+
+	QFile file( fileName );
+	if( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+		return false;
+
+	const QByteArray pid = QByteArray::number( QCoreApplication::applicationPid() );
+	QByteArray out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	auto separate = [&]() {
+		if( !first )
+			out += ",\n";
+		first = false;
+	};
+
+	for( const Thread &thread : threads ) {
+		const QByteArray tid = QByteArray::number( thread.tid );
+		separate();
+		out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"name\":\"";
+		appendEscaped( out, thread.name.toUtf8() );
+		out += "\"}}";
+
+		for( const Event &e : thread.events ) {
+			separate();
+			out += "{\"name\":\"";
+			appendEscaped( out, e.name );
+			out += "\",\"cat\":\"hash\",\"ph\":\"X\",\"pid\":" + pid + ",\"tid\":" + tid
+				 + ",\"ts\":" + micros( e.start - origin ) + ",\"dur\":" + micros( e.end - e.start );
+			if( e.arg >= 0 )
+				out += ",\"args\":{\"bytes\":" + QByteArray::number( e.arg ) + "}";
+			out += '}';
+
+			if( out.size() >= WRITE_SIZE ) {
+				if( file.write( out ) != out.size() )
+					return false;
+				out.clear();
+			}
+		}
+	}
+	out += "\n]}\n";
+	return file.write( out ) == out.size() && file.flush();
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <QtCore/QString>
+
+#include <atomic>
+
+/**
+ * Optional timeline of what the hashing threads are doing, exported in the
+ * Chrome trace event format for chrome://tracing or ui.perfetto.dev.
+ *
+ * Every thread records its spans into a ring buffer of its own without any
+ * locking, only the most recent spans of each thread are kept. Spans of
+ * exited threads share a fixed budget, the oldest threads go first. While
+ * tracing is disabled a span costs one relaxed atomic load.
+ */
+class Trace
+{
+public:
+	// Records the time between construction and destruction.
+	class Span
+	{
+	public:
+		explicit Span( const char *name, qint64 arg = -1 )
+			: name( name ), arg( arg ), start( Trace::timestamp() )
+		{}
+
+		~Span()
+		{
+			if( start )
+				Trace::record( name, start, arg );
+		}
+
+		void setArg( qint64 value ) { arg = value; }
+
+	private:
+		Q_DISABLE_COPY( Span )
+
+		const char *name;
+		qint64 arg;
+		quint64 start;
+	};
+
+	static void setEnabled( bool enabled );
+	static bool isEnabled() { return enabled.load( std::memory_order_relaxed ); }
+
+	// Nanoseconds on a monotonic clock, 0 while disabled.
+	static quint64 timestamp() { return isEnabled() ? now() : 0; }
+
+	// Records a span from start until now. The name has to outlive the
+	// trace, string literals are fine. The argument shows up as "bytes"
+	// unless negative.
+	static void record( const char *name, quint64 start, qint64 arg = -1 );
+
+	// Names the calling thread in the exported timeline.
+	static void setThreadName( const QString &name );
+
+	// Writes everything recorded so far. Spans recorded while exporting may
+	// be missing from the file.
+	static bool exportChromeTrace( const QString &fileName );
+
+private:
+	static inline std::atomic<bool> enabled { false };
+
+	static quint64 now();
+};
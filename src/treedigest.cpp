@@ -0,0 +1,559 @@
+#include "treedigest.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QSaveFile>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <QtCore/QtEndian>
+
+#include <algorithm>
+#include <atomic>
+
+#include "hashalgorithm.h"
+
+#ifdef Q_OS_UNIX
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC 0x49535444 // "ISTD"
+#define CACHE_VERSION 1
+
+namespace {
+
+enum EntryType : quint8 {
+	FileEntryType = 'f',
+	DirEntryType = 'd',
+	LinkEntryType = 'l'
+};
+
+struct Entry
+{
+	QByteArray name;
+	quint8 type = FileEntryType;
+	quint32 mode = 0;
+	qint64 size = 0;
+	qint64 changed = 0; // change time in nanoseconds
+	quint64 inode = 0;
+	int child = -1;     // index of the subdirectory
+	QByteArray digest;
+};
+
+struct Dir
+{
+	QByteArray path;
+	QVector<Entry> entries;
+	QByteArray signature;
+	QByteArray digest;
+	bool cached = false;
+};
+
+// What a file looked like when its digest was taken.
+struct FileState
+{
+	qint64 size;
+	qint64 changed;
+	quint64 inode;
+	QByteArray digest;
+};
+
+struct CachedDir
+{
+	QByteArray signature;
+	QByteArray digest;
+	QHash<QByteArray, FileState> files;
+};
+
+QByteArray joinPath( const QByteArray &dir, const QByteArray &name )
+{
+	return dir.endsWith( '/' ) ? dir + name : dir + '/' + name;
+}
+
+void appendU32( QByteArray &out, quint32 value )
+{
+	char buf[4];
+	qToBigEndian( value, buf );
+	out.append( buf, 4 );
+}
+
+void appendU64( QByteArray &out, quint64 value )
+{
+	char buf[8];
+	qToBigEndian( value, buf );
+	out.append( buf, 8 );
+}
+
+QDataStream& operator<<( QDataStream &stream, const FileState &state )
+{
+	return stream << state.size << state.changed << state.inode << state.digest;
+}
+
+QDataStream& operator>>( QDataStream &stream, FileState &state )
+{
+	return stream >> state.size >> state.changed >> state.inode >> state.digest;
+}
+
+QDataStream& operator<<( QDataStream &stream, const CachedDir &dir )
+{
+	return stream << dir.signature << dir.digest << dir.files;
+}
+
+QDataStream& operator>>( QDataStream &stream, CachedDir &dir )
+{
+	return stream >> dir.signature >> dir.digest >> dir.files;
+}
+
+class TreeMonitor : public HashMonitor
+{
+public:
+	TreeMonitor( std::atomic<quint64> &doneBytes, const std::atomic<bool> &stop, Throttle &throttle )
+		: doneBytes( doneBytes ), stop( stop ), throttle( throttle ), reported( 0 )
+	{}
+
+	bool update( quint64 done ) override
+	{
+		doneBytes += done - reported;
+		throttle.acquire( done - reported, &stop );
+		reported = done;
+		return !stop;
+	}
+
+private:
+	std::atomic<quint64> &doneBytes;
+	const std::atomic<bool> &stop;
+	Throttle &throttle;
+	quint64 reported;
+};
+
+} // namespace
+
+class TreeDigest::Private {
+public:
+	Private( const HashAlgorithm *algorithm )
+		: algorithm( algorithm ), maxThreads( QThread::idealThreadCount() )
+	{}
+
+	const HashAlgorithm *algorithm;
+	QString root;
+	int maxThreads;
+
+	QVector<Dir> dirs; // parents always come before their children
+	QHash<QByteArray, CachedDir> cache;
+	QByteArray result;
+
+	Throttle throttle;
+	std::atomic<int> priority { Throttle::NormalPriority };
+
+	std::atomic<bool> stop { false };
+	std::atomic<quint64> inputBytes { 0 };
+	std::atomic<quint64> doneBytes { 0 };
+	std::atomic<quint64> hashed { 0 };
+	std::atomic<quint64> reused { 0 };
+	std::atomic<quint64> failed { 0 };
+
+	QByteArray digest( const QByteArray &data ) const
+	{
+		return algorithm->hashBuffer( data.constData(), data.size() );
+	}
+
+	// Cheap fingerprint of a directory and everything below it, taken from
+	// the metadata only.
+	QByteArray signature( const Dir &dir ) const
+	{
+		QByteArray record;
+		for( const Entry &e : dir.entries ) {
+			record += char( e.type );
+			appendU32( record, e.mode );
+			appendU64( record, quint64( e.size ) );
+			appendU64( record, quint64( e.changed ) );
+			appendU64( record, e.inode );
+			appendU32( record, quint32( e.name.size() ) );
+			record += e.name;
+			if( e.child >= 0 )
+				record += dirs.at( e.child ).signature;
+		}
+		return digest( record );
+	}
+
+	// The canonical record only holds what is compared across machines.
+	QByteArray combine( const Dir &dir ) const
+	{
+		QByteArray record;
+		for( const Entry &e : dir.entries ) {
+			record += char( e.type );
+			appendU32( record, e.mode );
+			appendU64( record, quint64( e.size ) );
+			appendU32( record, quint32( e.name.size() ) );
+			record += e.name;
+			record += e.child >= 0 ? dirs.at( e.child ).digest : e.digest;
+		}
+		return digest( record );
+	}
+};
+
+TreeDigest::TreeDigest( QObject *parent, const HashAlgorithm *algorithm )
+	: QThread( parent ), d( new TreeDigest::Private( algorithm ? algorithm : HashAlgorithm::defaultAlgorithm() ) )
+{
+}
+
+TreeDigest::~TreeDigest()
+{
+	d->stop = true;
+	wait();
+	delete d;
+}
+
+void TreeDigest::setInput( const QString &root )
+{
+	d->root = QFileInfo( root ).absoluteFilePath();
+}
+
+void TreeDigest::setMaxThreads( int count )
+{
+	d->maxThreads = count > 0 ? count : QThread::idealThreadCount();
+}
+
+void TreeDigest::setPriority( Throttle::Priority priority )
+{
+	d->priority = priority;
+}
+
+void TreeDigest::setBandwidthLimit( double mbps )
+{
+	d->throttle.setLimit( mbps );
+}
+
+bool TreeDigest::loadCache( const QString &fileName )
+{
+	QFile file( fileName );
+	if( !file.open( QIODevice::ReadOnly ) )
+		return false;
+
+	QDataStream stream( &file );
+	quint32 magic = 0, version = 0;
+	QString algorithm;
+	stream >> magic >> version >> algorithm;
+	if( magic != CACHE_MAGIC || version != CACHE_VERSION || algorithm != d->algorithm->name )
+		return false;
+
+	QHash<QByteArray, CachedDir> cache;
+	stream >> cache;
+	if( stream.status() != QDataStream::Ok )
+		return false;
+	d->cache.swap( cache );
+	return true;
+}
+
+bool TreeDigest::saveCache( const QString &fileName ) const
+{
+	QSaveFile file( fileName );
+	if( !file.open( QIODevice::WriteOnly ) )
+		return false;
+
+	QDataStream stream( &file );
+	stream << quint32( CACHE_MAGIC ) << quint32( CACHE_VERSION ) << d->algorithm->name << d->cache;
+	return stream.status() == QDataStream::Ok && file.commit();
+}
+
+QByteArray TreeDigest::result() const
+{
+	return d->result;
+}
+
+quint64 TreeDigest::hashedFiles() const
+{
+	return d->hashed;
+}
+
+quint64 TreeDigest::reusedFiles() const
+{
+	return d->reused;
+}
+
+quint64 TreeDigest::failedEntries() const
+{
+	return d->failed;
+}
+
+void TreeDigest::stopProcess()
+{
+	d->stop = true;
+}
+
+void TreeDigest::run()
+{
+	d->stop = false;
+	d->result.clear();
+	d->dirs.clear();
+	d->inputBytes = d->doneBytes = 0;
+	d->hashed = d->reused = d->failed = 0;
+
+	if( !scan() || d->stop ) {
+		emit progressChanged( 0.0f );
+		return;
+	}
+
+	// Signatures bottom-up, children sit behind their parents.
+	for( int i = d->dirs.size() - 1; i >= 0; i-- )
+		d->dirs[i].signature = d->signature( d->dirs.at( i ) );
+
+	// Unchanged directories keep their digest, unchanged files in changed
+	// directories keep theirs. Everything else is hashed. The jobs get
+	// pointers taken here, the workers never touch the shared vectors.
+	QVector<QPair<QByteArray, QByteArray*>> jobs;
+	for( int i = 0; i < d->dirs.size(); i++ ) {
+		Dir &dir = d->dirs[i];
+		const auto cached = d->cache.constFind( dir.path );
+		if( cached != d->cache.constEnd() && cached->signature == dir.signature ) {
+			dir.digest = cached->digest;
+			dir.cached = true;
+		}
+		for( int j = 0; j < dir.entries.size(); j++ ) {
+			Entry &e = dir.entries[j];
+			if( e.type != FileEntryType )
+				continue;
+			if( cached != d->cache.constEnd() ) {
+				const auto state = cached->files.constFind( e.name );
+				if( state != cached->files.constEnd() && state->size == e.size
+						&& state->changed == e.changed && state->inode == e.inode ) {
+					e.digest = state->digest;
+					d->reused++;
+					continue;
+				}
+			}
+			jobs.append( qMakePair( joinPath( dir.path, e.name ), &e.digest ) );
+			d->inputBytes += e.size;
+		}
+	}
+
+	QThreadPool pool;
+	pool.setMaxThreadCount( d->maxThreads );
+	for( const auto &job : qAsConst( jobs ) )
+		pool.start( [this, job]() { hashFile( job.first, job.second ); } );
+
+	// Report progress while the workers are busy.
+	while( !pool.waitForDone( 100 ) ) {
+		if( d->inputBytes )
+			emit progressChanged( (float)d->doneBytes / d->inputBytes );
+	}
+	if( d->stop || d->failed ) {
+		emit progressChanged( 0.0f );
+		return;
+	}
+
+	// Directories that vanished from this tree leave the cache, other
+	// trees stay untouched.
+	const QByteArray root = d->dirs.first().path;
+	const QByteArray prefix = joinPath( root, QByteArray() );
+	for( auto it = d->cache.begin(); it != d->cache.end(); ) {
+		if( it.key() == root || it.key().startsWith( prefix ) )
+			it = d->cache.erase( it );
+		else
+			++it;
+	}
+
+	// Only directories with a changed signature are recombined, which is
+	// the changed one itself and its parents up to the root.
+	for( int i = d->dirs.size() - 1; i >= 0; i-- ) {
+		Dir &dir = d->dirs[i];
+		if( !dir.cached )
+			dir.digest = d->combine( dir );
+
+		CachedDir &entry = d->cache[dir.path];
+		entry.signature = dir.signature;
+		entry.digest = dir.digest;
+		for( const Entry &e : qAsConst( dir.entries ) ) {
+			if( e.type == FileEntryType )
+				entry.files.insert( e.name, FileState { e.size, e.changed, e.inode, e.digest } );
+		}
+	}
+	d->result = d->dirs.first().digest;
+
+	emit progressChanged( 1.0f );
+	emit treeDone( d->result );
+}
+
+void TreeDigest::hashFile( const QByteArray &path, QByteArray *digest )
+{
+	if( d->stop )
+		return;
+
+	Throttle::setCurrentThreadPriority( Throttle::Priority( d->priority.load() ) );
+
+	QFile file( QFile::decodeName( path ) );
+	if( !file.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) ) {
+		d->failed++;
+		return;
+	}
+
+	TreeMonitor monitor( d->doneBytes, d->stop, d->throttle );
+	*digest = d->algorithm->hash( &file, &monitor, IOBackend::Stream );
+	if( digest->isEmpty() && !d->stop )
+		d->failed++;
+	else
+		d->hashed++;
+}
+
+#ifdef Q_OS_UNIX
+
+bool TreeDigest::scan()
+{
+	const QByteArray root = QFile::encodeName( d->root );
+	struct stat st;
+	if( lstat( root.constData(), &st ) != 0 || !S_ISDIR( st.st_mode ) ) {
+		d->failed++;
+		return false;
+	}
+
+	Dir top;
+	top.path = root.endsWith( '/' ) && root.size() > 1 ? root.left( root.size() - 1 ) : root;
+	d->dirs.append( top );
+
+	// Breadth first, so parents always sit in front of their children.
+	for( int i = 0; i < d->dirs.size() && !d->stop; i++ ) {
+		const QByteArray path = d->dirs.at( i ).path;
+		DIR *dir = opendir( path.constData() );
+		if( !dir ) {
+			d->failed++;
+			return false;
+		}
+
+		QVector<Entry> entries;
+		while( struct dirent *ent = readdir( dir ) ) {
+			if( ent->d_name[0] == '.' && (ent->d_name[1] == '\0' ||
+					(ent->d_name[1] == '.' && ent->d_name[2] == '\0')) )
+				continue;
+			Entry e;
+			e.name = QByteArray( ent->d_name );
+			e.inode = ent->d_ino;
+			entries.append( e );
+		}
+
+		// Stat in inode order, then sort by name for the canonical order.
+		std::sort( entries.begin(), entries.end(), []( const Entry &a, const Entry &b ) {
+			return a.inode < b.inode;
+		} );
+		const int fd = dirfd( dir );
+		QVector<Entry> kept;
+		kept.reserve( entries.size() );
+		for( Entry &e : entries ) {
+			if( fstatat( fd, e.name.constData(), &st, AT_SYMLINK_NOFOLLOW ) != 0 ) {
+				d->failed++;
+				continue;
+			}
+			e.mode = st.st_mode & 07777;
+			e.inode = st.st_ino;
+			e.changed = qint64( st.st_ctim.tv_sec ) * 1000000000 + st.st_ctim.tv_nsec;
+			if( S_ISREG( st.st_mode ) ) {
+				e.type = FileEntryType;
+				e.size = st.st_size;
+			} else if( S_ISDIR( st.st_mode ) ) {
+				e.type = DirEntryType;
+			} else if( S_ISLNK( st.st_mode ) ) {
+				QByteArray target( st.st_size + 1, Qt::Uninitialized );
+				const ssize_t len = readlinkat( fd, e.name.constData(), target.data(), target.size() );
+				if( len < 0 ) {
+					d->failed++;
+					continue;
+				}
+				target.truncate( len );
+				e.type = LinkEntryType;
+				e.size = len;
+				e.digest = d->digest( target );
+			} else {
+				// Devices, sockets and pipes have no content to compare.
+				continue;
+			}
+			kept.append( e );
+		}
+		closedir( dir );
+
+		std::sort( kept.begin(), kept.end(), []( const Entry &a, const Entry &b ) {
+			return a.name < b.name;
+		} );
+		for( Entry &e : kept ) {
+			if( e.type == DirEntryType ) {
+				e.child = d->dirs.size();
+				Dir child;
+				child.path = joinPath( path, e.name );
+				d->dirs.append( child );
+			}
+		}
+		d->dirs[i].entries = kept;
+	}
+	return d->failed == 0;
+}
+
+#else
+
+bool TreeDigest::scan()
+{
+	if( !QFileInfo( d->root ).isDir() ) {
+		d->failed++;
+		return false;
+	}
+
+	Dir top;
+	top.path = QFile::encodeName( QDir::cleanPath( d->root ) );
+	d->dirs.append( top );
+
+	for( int i = 0; i < d->dirs.size() && !d->stop; i++ ) {
+		const QByteArray path = d->dirs.at( i ).path;
+		const QFileInfoList infos = QDir( QFile::decodeName( path ) ).entryInfoList(
+				QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot, QDir::NoSort );
+
+		QVector<Entry> kept;
+		for( const QFileInfo &info : infos ) {
+			Entry e;
+			e.name = QFile::encodeName( info.fileName() );
+			// Owner, group and other bits in Unix layout.
+			const quint32 p = quint32( info.permissions() );
+			e.mode = ((p >> 12) & 7) << 6 | ((p >> 4) & 7) << 3 | (p & 7);
+			e.changed = info.metadataChangeTime().toMSecsSinceEpoch() * 1000000;
+			if( info.isSymLink() ) {
+				// The link text as stored, like readlinkat() on Unix, not the
+				// resolved absolute path that would tie the digest to the
+				// location of the tree.
+#if QT_VERSION >= QT_VERSION_CHECK( 6, 6, 0 )
+				const QByteArray target = QFile::encodeName( info.readSymLink() );
+#else
+				const QByteArray target = QFile::encodeName( info.dir().relativeFilePath( info.symLinkTarget() ) );
+#endif
+				e.type = LinkEntryType;
+				e.size = target.size();
+				e.digest = d->digest( target );
+			} else if( info.isDir() ) {
+				e.type = DirEntryType;
+			} else if( info.isFile() ) {
+				e.type = FileEntryType;
+				e.size = info.size();
+			} else {
+				continue;
+			}
+			kept.append( e );
+		}
+
+		std::sort( kept.begin(), kept.end(), []( const Entry &a, const Entry &b ) {
+			return a.name < b.name;
+		} );
+		for( Entry &e : kept ) {
+			if( e.type == DirEntryType ) {
+				e.child = d->dirs.size();
+				Dir child;
+				child.path = joinPath( path, e.name );
+				d->dirs.append( child );
+			}
+		}
+		d->dirs[i].entries = kept;
+	}
+	return d->failed == 0;
+}
+
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+#include <QtCore/QThread>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+#include "throttle.h"
+
+struct HashAlgorithm;
+
+/**
+ * Single digest over a whole directory tree.
+ *
+ * Every directory is digested from its entries in byte-wise name order,
+ * each entry contributing type, permission bits, size, name and the
+ * digest of its content: the file digest, the digest of a symbolic
+ * link's target or the digest of a subdirectory. The root digest only
+ * depends on the tree below the root, not on its location, the order
+ * of the directory listing or the number of threads.
+ *
+ * Files are hashed in parallel. Subtree digests are cached together with
+ * inode and change time of their entries, so a rerun only reads changed
+ * files and only recombines the directories on their way to the root.
+ */
+class TreeDigest : public QThread
+{
+	Q_OBJECT
+
+public:
+	TreeDigest( QObject *parent, const HashAlgorithm *algorithm );
+	~TreeDigest();
+
+	void setInput( const QString &root );
+	void setMaxThreads( int count );
+	void setPriority( Throttle::Priority priority );
+	// MB/s, 0 for no limit.
+	void setBandwidthLimit( double mbps );
+
+	// The cache is kept across runs of the same object and can be stored
+	// between processes. Loading fails for caches of another algorithm.
+	bool loadCache( const QString &fileName );
+	bool saveCache( const QString &fileName ) const;
+
+	// Empty if the run was stopped or any entry could not be read.
+	QByteArray result() const;
+	quint64 hashedFiles() const;
+	quint64 reusedFiles() const;
+	quint64 failedEntries() const;
+
+protected:
+	void run();
+
+public slots:
+	void stopProcess();
+
+private:
+	class Private;
+	Private *d;
+
+	bool scan();
+	void hashFile( const QByteArray &path, QByteArray *digest );
+
+signals:
+	void progressChanged( float );
+	void treeDone( QByteArray );
+};
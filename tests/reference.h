@@ -0,0 +1,56 @@
+#pragma once
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QRandomGenerator>
+
+#include <functional>
+#include <memory>
+
+#include "hashalgorithm.h"
+
+/**
+ * Plain reference path for the tests: Crypto++ through its virtual
+ * interface on an in-memory buffer, no kernels and no I/O backends.
+ */
+namespace Reference {
+
+typedef std::function<CryptoPP::HashTransformation*()> Factory;
+
+template<class Hash>
+void addFactory( QHash<QString, Factory> &factories )
+{
+	const HashAlgorithm *algo = HashAlgorithm::find( QString::fromLatin1( Hash::StaticAlgorithmName() ) );
+	if( algo )
+		factories.insert( algo->name, []() -> CryptoPP::HashTransformation* { return new Hash; } );
+}
+
+template<class... Hashes>
+QHash<QString, Factory> makeFactories( AlgorithmList<Hashes...> )
+{
+	QHash<QString, Factory> factories;
+	(addFactory<Hashes>( factories ), ...);
+	return factories;
+}
+
+inline QByteArray digest( const QString &name, const QByteArray &data )
+{
+	static const QHash<QString, Factory> factories = makeFactories( Algorithms() );
+	std::unique_ptr<CryptoPP::HashTransformation> hash( factories.value( name )() );
+	QByteArray result( int( hash->DigestSize() ), '\0' );
+	hash->CalculateDigest( (CryptoPP::byte*)result.data(),
+						   (const CryptoPP::byte*)data.constData(), std::size_t( data.size() ) );
+	return result;
+}
+
+inline QByteArray randomData( qsizetype size, quint32 seed )
+{
+	QByteArray data( size, Qt::Uninitialized );
+	QRandomGenerator rng( seed );
+	const qsizetype words = size / qsizetype( sizeof( quint32 ) );
+	rng.fillRange( reinterpret_cast<quint32*>( data.data() ), words );
+	for( qsizetype i = words * qsizetype( sizeof( quint32 ) ); i < size; i++ )
+		data[i] = char( rng.generate() );
+	return data;
+}
+
+} // namespace Reference
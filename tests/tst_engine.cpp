@@ -0,0 +1,699 @@
+#include <QtTest/QtTest>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtNetwork/QLocalSocket>
+
+#include <algorithm>
+#include <thread>
+
+#include "batchhasher.h"
+#include "chunker.h"
+#include "hashdaemon.h"
+#include "manifestdiff.h"
+#include "manifestwriter.h"
+#include "resultstore.h"
+#include "throttle.h"
+#include "trace.h"
+#include "treedigest.h"
+#include "reference.h"
+
+class TestEngine : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void batchMatchesPlain_data();
+	void batchMatchesPlain();
+	void chunkBounds();
+	void chunkParallel();
+	void resultStore();
+	void throttle();
+	void daemonProtocol();
+	void daemon();
+	void treeDigest();
+	void trace();
+	void manifest_data();
+	void manifest();
+	void manifestMultiPass();
+	void manifestParse();
+	void manifestDiff_data();
+	void manifestDiff();
+	void manifestDiffError();
+
+private:
+	QTemporaryDir dir;
+	QHash<QString, QByteArray> files; // path -> content
+
+	void writeFile( const QString &relative, const QByteArray &data );
+	DedupStats analyze( const QStringList &paths, int threads );
+};
+
+void TestEngine::writeFile( const QString &relative, const QByteArray &data )
+{
+	const QString path = dir.filePath( relative );
+	QDir().mkpath( QFileInfo( path ).absolutePath() );
+	QFile file( path );
+	QVERIFY( file.open( QIODevice::WriteOnly ) );
+	QCOMPARE( file.write( data ), qint64( data.size() ) );
+	files.insert( QFileInfo( path ).absoluteFilePath(), data );
+}
+
+void TestEngine::initTestCase()
+{
+	QVERIFY( dir.isValid() );
+
+	// A small tree with empty, tiny, block sized and multi-buffer files.
+	const int sizes[] = { 0, 1, 64, 4095, 4096, 4097, 65536, 1024 * 1024 + 3, 3 * 1024 * 1024 };
+	int n = 0;
+	for( int size : sizes ) {
+		writeFile( QString( "a/file%1" ).arg( n ), Reference::randomData( size, n ) );
+		writeFile( QString( "b/c/file%1" ).arg( n ), Reference::randomData( size / 3, n + 100 ) );
+		n++;
+	}
+	for( int i = 0; i < 200; i++ )
+		writeFile( QString( "small/%1.txt" ).arg( i ), Reference::randomData( i * 37 % 5000, i + 1000 ) );
+}
+
+void TestEngine::batchMatchesPlain_data()
+{
+	QTest::addColumn<QString>( "algorithm" );
+	QTest::addColumn<int>( "threads" );
+
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		QTest::addRow( "%s-serial", qPrintable( algo.name ) ) << algo.name << 1;
+		QTest::addRow( "%s-parallel", qPrintable( algo.name ) ) << algo.name << 8;
+	}
+}
+
+void TestEngine::batchMatchesPlain()
+{
+	QFETCH( QString, algorithm );
+	QFETCH( int, threads );
+
+	BatchHasher hasher;
+	QVERIFY( hasher.setAlgorithm( algorithm ) );
+	hasher.setInput( QStringList() << dir.path() );
+	hasher.setMaxThreads( threads );
+
+	// Batches are emitted from the hasher thread only.
+	QHash<QString, QByteArray> digests;
+	connect( &hasher, &BatchHasher::resultsReady, this, [&digests]( const QVector<HashResult> &batch ) {
+		for( const HashResult &r : batch )
+			digests.insert( QFileInfo( r.path ).absoluteFilePath(), r.digest );
+	}, Qt::DirectConnection );
+
+	hasher.start();
+	QVERIFY( hasher.wait( 120000 ) );
+
+	QCOMPARE( digests.size(), files.size() );
+	for( auto it = files.constBegin(); it != files.constEnd(); ++it )
+		QCOMPARE( digests.value( it.key() ), Reference::digest( algorithm, it.value() ) );
+}
+
+void TestEngine::chunkBounds()
+{
+	ChunkerParams params;
+	QVERIFY( params.isValid() );
+	GearChunker chunker( params );
+
+	const QByteArray data = Reference::randomData( 16 * 1024 * 1024, 7 );
+	const uchar *p = (const uchar*)data.constData();
+	std::size_t pos = 0;
+	std::size_t chunks = 0;
+	while( pos < std::size_t( data.size() ) ) {
+		const std::size_t rest = std::size_t( data.size() ) - pos;
+		const std::size_t len = chunker.cut( p + pos, rest );
+		QVERIFY( len > 0 && len <= params.maxSize );
+		QVERIFY( len >= params.minSize || len == rest );
+		pos += len;
+		chunks++;
+	}
+
+	// Normalized chunking keeps the mean close to the configured average.
+	const std::size_t mean = data.size() / chunks;
+	QVERIFY2( mean > params.avgSize / 2 && mean < params.avgSize * 2, qPrintable( QString::number( mean ) ) );
+}
+
+DedupStats TestEngine::analyze( const QStringList &paths, int threads )
+{
+	CIChunkAnalysis analysis( nullptr, ChunkerParams() );
+	analysis.setInput( paths );
+	analysis.setMaxThreads( threads );
+	analysis.start();
+	analysis.wait();
+	return analysis.result();
+}
+
+void TestEngine::chunkParallel()
+{
+	QTemporaryDir dedupDir;
+	QVERIFY( dedupDir.isValid() );
+
+	// Two copies of the same data and one with an insertion in the middle.
+	const QByteArray a = Reference::randomData( 4 * 1024 * 1024, 99 );
+	QByteArray c = a;
+	c.insert( c.size() / 2, Reference::randomData( 100, 100 ) );
+	for( const auto &entry : { qMakePair( QString( "a" ), a ), qMakePair( QString( "b" ), a ),
+							   qMakePair( QString( "c" ), c ) } ) {
+		QFile file( dedupDir.filePath( entry.first ) );
+		QVERIFY( file.open( QIODevice::WriteOnly ) );
+		file.write( entry.second );
+	}
+
+	const DedupStats serial = analyze( QStringList() << dedupDir.path(), 1 );
+	const DedupStats parallel = analyze( QStringList() << dedupDir.path(), 8 );
+
+	QCOMPARE( serial.files, quint64( 3 ) );
+	QCOMPARE( serial.totalBytes, quint64( 2 * a.size() + c.size() ) );
+	QCOMPARE( parallel.totalBytes, serial.totalBytes );
+	QCOMPARE( parallel.totalChunks, serial.totalChunks );
+	QCOMPARE( parallel.uniqueChunks, serial.uniqueChunks );
+	QCOMPARE( parallel.uniqueBytes, serial.uniqueBytes );
+
+	// Only the chunks around the insertion may be new.
+	QVERIFY( serial.uniqueBytes < quint64( a.size() ) + 4 * ChunkerParams().maxSize );
+}
+
+void TestEngine::resultStore()
+{
+	ResultStore store( 4 );
+	store.append( HashResult { "/x/y/one", 10, QByteArray( "\x01\x02\x03\x04", 4 ) } );
+	store.append( HashResult { "/x/y/two", 20, QByteArray() } );
+	store.append( HashResult { "/x/z/three", 30, QByteArray( "\xff\xfe\xfd\xfc", 4 ) } );
+
+	QCOMPARE( store.count(), quint32( 3 ) );
+	QCOMPARE( store.directoryCount(), quint32( 2 ) );
+	QCOMPARE( store.path( 0 ), QString( "/x/y/one" ) );
+	QCOMPARE( store.fileName( 2 ), QString( "three" ) );
+	QCOMPARE( store.directory( 1 ), QString( "/x/y" ) );
+	QCOMPARE( store.size( 1 ), qint64( 20 ) );
+	QVERIFY( !store.failed( 0 ) );
+	QVERIFY( store.failed( 1 ) );
+	QCOMPARE( store.digestHex( 0 ), QString( "01020304" ) );
+	QCOMPARE( store.digestHex( 2 ), QString( "fffefdfc" ) );
+}
+
+void TestEngine::throttle()
+{
+	const quint64 mb = 1024 * 1024;
+	Throttle throttle;
+	QCOMPARE( throttle.limit(), 0.0 );
+
+	// 10 MB at 20 MB/s take about half a second.
+	throttle.setLimit( 20 );
+	QElapsedTimer timer;
+	timer.start();
+	for( int i = 0; i < 10; i++ )
+		throttle.acquire( mb );
+	QVERIFY2( timer.elapsed() >= 400, qPrintable( QString::number( timer.elapsed() ) ) );
+
+	// Lifting the limit from another thread releases a waiting worker.
+	throttle.setLimit( 1 );
+	QThread *lifter = QThread::create( [&throttle]() {
+		QThread::msleep( 100 );
+		throttle.setLimit( 0 );
+	} );
+	lifter->start();
+	timer.restart();
+	throttle.acquire( 100 * mb );
+	QVERIFY( timer.elapsed() < 5000 );
+	lifter->wait();
+	delete lifter;
+
+	// A stop request ends the wait as well.
+	std::atomic<bool> stop { true };
+	throttle.setLimit( 1 );
+	timer.restart();
+	throttle.acquire( 100 * mb, &stop );
+	QVERIFY( timer.elapsed() < 1000 );
+}
+
+void TestEngine::daemonProtocol()
+{
+	HashDaemon::Request request;
+	request.type = HashDaemon::VerifyRequest;
+	request.id = 0xdeadbeef;
+	request.algorithm = "sha256";
+	request.path = QString::fromUtf8( "/tmp/\xc3\xa4 b" );
+	request.expected = QByteArray( 32, '\x5a' );
+
+	// Two frames, delivered in pieces.
+	const QByteArray wire = HashDaemon::encode( request ) + HashDaemon::encode( request );
+	QByteArray buffer = wire.left( 10 );
+	HashDaemon::Request decoded;
+	QVERIFY( !HashDaemon::decode( buffer, &decoded ) );
+	buffer += wire.mid( 10 );
+	for( int i = 0; i < 2; i++ ) {
+		QVERIFY( HashDaemon::decode( buffer, &decoded ) );
+		QCOMPARE( decoded.type, request.type );
+		QCOMPARE( decoded.id, request.id );
+		QCOMPARE( decoded.algorithm, request.algorithm );
+		QCOMPARE( decoded.path, request.path );
+		QCOMPARE( decoded.expected, request.expected );
+	}
+	QVERIFY( buffer.isEmpty() );
+
+	HashDaemon::Response response;
+	response.status = HashDaemon::Mismatch;
+	response.id = 7;
+	response.digest = "digest";
+	buffer = HashDaemon::encode( response );
+	HashDaemon::Response decodedResponse;
+	QVERIFY( HashDaemon::decode( buffer, &decodedResponse ) );
+	QCOMPARE( decodedResponse.status, response.status );
+	QCOMPARE( decodedResponse.id, response.id );
+	QCOMPARE( decodedResponse.digest, response.digest );
+}
+
+void TestEngine::daemon()
+{
+	const QString name = QString( "insaneSums-test-%1" ).arg( QCoreApplication::applicationPid() );
+	HashDaemon daemon;
+	daemon.setMaxThreads( 2 );
+	QVERIFY2( daemon.listen( name ), qPrintable( daemon.errorString() ) );
+	HashDaemon second;
+	QVERIFY( !second.listen( name ) );
+
+	// Two clients asking for the same files, the second one twice.
+	const QStringList paths = files.keys();
+	QLocalSocket a, b;
+	for( QLocalSocket *socket : { &a, &b } ) {
+		socket->connectToServer( name );
+		QVERIFY( socket->waitForConnected( 5000 ) );
+	}
+	for( int i = 0; i < paths.size(); i++ ) {
+		HashDaemon::Request request;
+		request.id = quint32( i );
+		request.algorithm = "sha256";
+		request.path = paths.at( i );
+		a.write( HashDaemon::encode( request ) );
+		b.write( HashDaemon::encode( request ) );
+		b.write( HashDaemon::encode( request ) );
+	}
+	HashDaemon::Request verify;
+	verify.type = HashDaemon::VerifyRequest;
+	verify.id = quint32( paths.size() );
+	verify.algorithm = "sha256";
+	verify.path = paths.first();
+	verify.expected = QByteArray( 32, '\0' );
+	a.write( HashDaemon::encode( verify ) );
+
+	QByteArray bufferA, bufferB;
+	QVector<HashDaemon::Response> responsesA, responsesB;
+	auto collect = []( QLocalSocket &socket, QByteArray &buffer, QVector<HashDaemon::Response> &responses ) {
+		buffer += socket.readAll();
+		HashDaemon::Response response;
+		while( HashDaemon::decode( buffer, &response ) )
+			responses.append( response );
+	};
+	QTRY_VERIFY_WITH_TIMEOUT( (collect( a, bufferA, responsesA ), collect( b, bufferB, responsesB ),
+			responsesA.size() == paths.size() + 1 && responsesB.size() == 2 * paths.size()), 60000 );
+
+	for( const auto &responses : { responsesA, responsesB } ) {
+		for( const HashDaemon::Response &response : responses ) {
+			if( response.id == quint32( paths.size() ) ) {
+				QCOMPARE( response.status, quint8( HashDaemon::Mismatch ) );
+				continue;
+			}
+			const QString path = paths.at( int( response.id ) );
+			QCOMPARE( response.status, quint8( HashDaemon::Ok ) );
+			QCOMPARE( response.digest, Reference::digest( "sha256", files.value( path ) ) );
+		}
+	}
+	// Every file was read once, repeated requests were coalesced or cached.
+	QCOMPARE( daemon.hashedFiles(), quint64( paths.size() ) );
+
+	// A throttled read of a new file keeps the job running for about a
+	// second, requests of other clients arriving meanwhile must join it.
+	QTemporaryDir slowDir;
+	QVERIFY( slowDir.isValid() );
+	const QString slowPath = slowDir.filePath( "slow" );
+	const QByteArray slowData = Reference::randomData( 1024 * 1024 + 1, 7 );
+	{
+		QFile file( slowPath );
+		QVERIFY( file.open( QIODevice::WriteOnly ) );
+		QCOMPARE( file.write( slowData ), qint64( slowData.size() ) );
+	}
+	daemon.setBandwidthLimit( 1 );
+	const quint64 hashed = daemon.hashedFiles();
+	const quint64 coalesced = daemon.coalescedRequests();
+
+	const int clientCount = 4;
+	QLocalSocket clients[clientCount];
+	QByteArray buffers[clientCount];
+	QVector<HashDaemon::Response> responses[clientCount];
+	for( QLocalSocket &socket : clients ) {
+		socket.connectToServer( name );
+		QVERIFY( socket.waitForConnected( 5000 ) );
+		HashDaemon::Request request;
+		request.algorithm = "sha256";
+		request.path = slowPath;
+		socket.write( HashDaemon::encode( request ) );
+	}
+	QTRY_VERIFY_WITH_TIMEOUT( ([&]() {
+		bool done = true;
+		for( int i = 0; i < clientCount; i++ ) {
+			collect( clients[i], buffers[i], responses[i] );
+			done = done && responses[i].size() == 1;
+		}
+		return done;
+	}()), 60000 );
+	for( const auto &response : responses ) {
+		QCOMPARE( response.first().status, quint8( HashDaemon::Ok ) );
+		QCOMPARE( response.first().digest, Reference::digest( "sha256", slowData ) );
+	}
+	QCOMPARE( daemon.hashedFiles() - hashed, quint64( 1 ) );
+	QCOMPARE( daemon.coalescedRequests() - coalesced, quint64( clientCount - 1 ) );
+}
+
+void TestEngine::treeDigest()
+{
+	// The same tree, created in different orders.
+	QTemporaryDir a, b;
+	QVERIFY( a.isValid() && b.isValid() );
+	const QStringList names = QStringList() << "x/1" << "x/2" << "x/y/3" << "z/4" << "5" << "x/y/w/6";
+	for( int i = 0; i < names.size(); i++ ) {
+		const int j = names.size() - 1 - i;
+		for( const auto &entry : { qMakePair( a.filePath( names.at( i ) ), i ), qMakePair( b.filePath( names.at( j ) ), j ) } ) {
+			QDir().mkpath( QFileInfo( entry.first ).absolutePath() );
+			QFile file( entry.first );
+			QVERIFY( file.open( QIODevice::WriteOnly ) );
+			file.write( Reference::randomData( 1000 * entry.second, quint32( entry.second ) ) );
+		}
+	}
+
+	TreeDigest first( nullptr, HashAlgorithm::find( "sha256" ) );
+	first.setInput( a.path() );
+	first.setMaxThreads( 1 );
+	first.start();
+	QVERIFY( first.wait( 60000 ) );
+	const QByteArray digest = first.result();
+	QCOMPARE( digest.size(), 32 );
+	QCOMPARE( first.hashedFiles(), quint64( names.size() ) );
+
+	TreeDigest second( nullptr, HashAlgorithm::find( "sha256" ) );
+	second.setInput( b.path() );
+	second.setMaxThreads( 8 );
+	second.start();
+	QVERIFY( second.wait( 60000 ) );
+	QCOMPARE( second.result(), digest );
+
+	// A rerun reads nothing.
+	first.start();
+	QVERIFY( first.wait( 60000 ) );
+	QCOMPARE( first.result(), digest );
+	QCOMPARE( first.hashedFiles(), quint64( 0 ) );
+	QCOMPARE( first.reusedFiles(), quint64( names.size() ) );
+
+	// A changed leaf only rereads that file, and survives a saved cache.
+	{
+		QFile file( a.filePath( "x/y/w/6" ) );
+		QVERIFY( file.open( QIODevice::Append ) );
+		file.write( "more" );
+	}
+	QTemporaryDir cacheDir;
+	QVERIFY( cacheDir.isValid() );
+	const QString cacheFile = cacheDir.filePath( "tree.cache" );
+	QVERIFY( first.saveCache( cacheFile ) );
+	TreeDigest third( nullptr, HashAlgorithm::find( "sha256" ) );
+	QVERIFY( third.loadCache( cacheFile ) );
+	third.setInput( a.path() );
+	third.start();
+	QVERIFY( third.wait( 60000 ) );
+	QVERIFY( !third.result().isEmpty() );
+	QVERIFY( third.result() != digest );
+	QCOMPARE( third.hashedFiles(), quint64( 1 ) );
+
+	// Permission bits are part of the digest.
+	const QByteArray changed = third.result();
+	QVERIFY( QFile::setPermissions( a.filePath( "5" ), QFile::ReadOwner ) );
+	third.start();
+	QVERIFY( third.wait( 60000 ) );
+	QVERIFY( third.result() != changed );
+}
+
+void TestEngine::trace()
+{
+	Trace::setEnabled( true );
+	BatchHasher hasher;
+	hasher.setInput( QStringList() << dir.path() );
+	hasher.setMaxThreads( 4 );
+	hasher.start();
+	QVERIFY( hasher.wait( 120000 ) );
+
+	// Threads that exit hand their ring to the next thread, their spans
+	// must stay under their own name. join() waits for the ring's release.
+	for( const char *name : { "first", "second" } ) {
+		std::thread thread( [name]() {
+			Trace::setThreadName( name );
+			Trace::Span span( name );
+		} );
+		thread.join();
+	}
+	Trace::setEnabled( false );
+
+	// Nothing is recorded while disabled.
+	{
+		Trace::Span span( "disabled" );
+	}
+
+	QTemporaryDir outDir;
+	QVERIFY( outDir.isValid() );
+	const QString fileName = outDir.filePath( "trace.json" );
+	QVERIFY( Trace::exportChromeTrace( fileName ) );
+	QFile file( fileName );
+	QVERIFY( file.open( QIODevice::ReadOnly ) );
+	QJsonParseError error;
+	const QJsonDocument doc = QJsonDocument::fromJson( file.readAll(), &error );
+	QCOMPARE( error.error, QJsonParseError::NoError );
+
+	QSet<QString> names;
+	QHash<int, QString> threads;
+	QHash<QString, int> spanThreads;
+	for( const QJsonValue &value : doc.object().value( "traceEvents" ).toArray() ) {
+		const QJsonObject event = value.toObject();
+		const int tid = event.value( "tid" ).toInt();
+		if( event.value( "ph" ).toString() == "M" ) {
+			QVERIFY( !threads.contains( tid ) );
+			threads.insert( tid, event.value( "args" ).toObject().value( "name" ).toString() );
+		}
+		if( event.value( "ph" ).toString() != "X" )
+			continue;
+		QVERIFY( event.value( "dur" ).toDouble() >= 0 );
+		names.insert( event.value( "name" ).toString() );
+		spanThreads.insert( event.value( "name" ).toString(), tid );
+	}
+	QCOMPARE( threads.value( spanThreads.value( "first", -1 ) ), QString( "first" ) );
+	QCOMPARE( threads.value( spanThreads.value( "second", -1 ) ), QString( "second" ) );
+	for( const char *name : { "open", "read", "update", "file", "small files", "queue wait", "publish", "deliver" } )
+		QVERIFY2( names.contains( name ), name );
+	QVERIFY( !names.contains( "disabled" ) );
+}
+
+void TestEngine::manifest_data()
+{
+	QTest::addColumn<int>( "format" );
+	QTest::addColumn<bool>( "sorted" );
+	QTest::addColumn<qint64>( "sortMemory" );
+	QTest::addColumn<QByteArray>( "expected" );
+
+	const QByteArray coreutils =
+		"\\00ff  dir/new\\nline\n"
+		"0102  dir/b\n"
+		"a0b0  /elsewhere/a\n";
+	const QByteArray sortedCoreutils =
+		"a0b0  /elsewhere/a\n"
+		"0102  dir/b\n"
+		"\\00ff  dir/new\\nline\n";
+	QTest::newRow( "coreutils" ) << int( ManifestWriter::CoreutilsFormat ) << false << qint64( 1024 ) << coreutils;
+	QTest::newRow( "coreutils-sorted" ) << int( ManifestWriter::CoreutilsFormat ) << true << qint64( 1024 * 1024 ) << sortedCoreutils;
+	QTest::newRow( "coreutils-spilled" ) << int( ManifestWriter::CoreutilsFormat ) << true << qint64( 1 ) << sortedCoreutils;
+	QTest::newRow( "bsd" ) << int( ManifestWriter::BsdFormat ) << true << qint64( 1 ) << QByteArray(
+		"SHA256 (/elsewhere/a) = a0b0\n"
+		"SHA256 (dir/b) = 0102\n"
+		"\\SHA256 (dir/new\\nline) = 00ff\n" );
+	QTest::newRow( "jsonl" ) << int( ManifestWriter::JsonLinesFormat ) << false << qint64( 1024 ) << QByteArray(
+		"{\"path\":\"dir/new\\u000aline\",\"size\":3,\"algorithm\":\"sha256\",\"digest\":\"00ff\"}\n"
+		"{\"path\":\"dir/b\",\"size\":2,\"algorithm\":\"sha256\",\"digest\":\"0102\"}\n"
+		"{\"path\":\"dir/failed\",\"size\":0,\"algorithm\":\"sha256\",\"digest\":null}\n"
+		"{\"path\":\"/elsewhere/a\",\"size\":1,\"algorithm\":\"sha256\",\"digest\":\"a0b0\"}\n" );
+}
+
+void TestEngine::manifest()
+{
+	QFETCH( int, format );
+	QFETCH( bool, sorted );
+	QFETCH( qint64, sortMemory );
+	QFETCH( QByteArray, expected );
+
+	QTemporaryDir outDir;
+	QVERIFY( outDir.isValid() );
+	const QString fileName = outDir.filePath( "manifest.txt" );
+	{
+		ManifestWriter writer( HashAlgorithm::find( "sha256" ), ManifestWriter::Format( format ) );
+		writer.setBaseDirectory( QDir( "/base" ) );
+		writer.setSorted( sorted );
+		writer.setSortMemory( sortMemory );
+		QVERIFY( writer.open( fileName ) );
+		QVERIFY( writer.write( HashResult { "/base/dir/new\nline", 3, QByteArray( "\x00\xff", 2 ) } ) );
+		QVERIFY( writer.write( QVector<HashResult> {
+			HashResult { "/base/dir/b", 2, QByteArray( "\x01\x02", 2 ) },
+			HashResult { "/base/dir/failed", 0, QByteArray() },
+			HashResult { "/elsewhere/a", 1, QByteArray( "\xa0\xb0", 2 ) } } ) );
+		QVERIFY( writer.close() );
+		QCOMPARE( writer.failedCount(), quint64( 1 ) );
+	}
+
+	QFile file( fileName );
+	QVERIFY( file.open( QIODevice::ReadOnly ) );
+	QCOMPARE( file.readAll(), expected );
+}
+
+void TestEngine::manifestMultiPass()
+{
+	// One run per line, more than one merge pass can take.
+	QTemporaryDir outDir;
+	QVERIFY( outDir.isValid() );
+	const QString fileName = outDir.filePath( "manifest.txt" );
+	QByteArrayList expected;
+	{
+		ManifestWriter writer( HashAlgorithm::find( "sha256" ), ManifestWriter::CoreutilsFormat );
+		writer.setSorted( true );
+		writer.setSortMemory( 1 );
+		QVERIFY( writer.open( fileName ) );
+		for( int i = 0; i < 5000; i++ ) {
+			const QString path = QString( "file-%1" ).arg( quint32( i ) * 2654435761u );
+			QVERIFY( writer.write( HashResult { path, 1, QByteArray( "\x01", 1 ) } ) );
+			expected << "01  " + path.toUtf8();
+		}
+		QVERIFY2( writer.close(), qPrintable( writer.errorString() ) );
+	}
+	std::sort( expected.begin(), expected.end() );
+
+	QFile file( fileName );
+	QVERIFY( file.open( QIODevice::ReadOnly ) );
+	QCOMPARE( file.readAll(), expected.join( '\n' ) + '\n' );
+}
+
+void TestEngine::manifestParse()
+{
+	QByteArray path, digest;
+	QVERIFY( ManifestDiff::parseLine( "00ff  some file", &path, &digest ) );
+	QCOMPARE( path, QByteArray( "some file" ) );
+	QCOMPARE( digest, QByteArray( "\x00\xff", 2 ) );
+	QVERIFY( ManifestDiff::parseLine( "ABCD *bin/x", &path, &digest ) );
+	QCOMPARE( path, QByteArray( "bin/x" ) );
+	QCOMPARE( digest, QByteArray( "\xab\xcd", 2 ) );
+	QVERIFY( ManifestDiff::parseLine( "SHA256 (a (b) = c) = 0102", &path, &digest ) );
+	QCOMPARE( path, QByteArray( "a (b) = c" ) );
+	QCOMPARE( digest, QByteArray( "\x01\x02", 2 ) );
+	QVERIFY( ManifestDiff::parseLine( "\\0102  new\\nline\\\\", &path, &digest ) );
+	QCOMPARE( path, QByteArray( "new\nline\\" ) );
+	QVERIFY( ManifestDiff::parseLine( "\\SHA1 (x\\ny) = 0102", &path, &digest ) );
+	QCOMPARE( path, QByteArray( "x\ny" ) );
+
+	QVERIFY( !ManifestDiff::parseLine( "", &path, &digest ) );
+	QVERIFY( !ManifestDiff::parseLine( "0g  x", &path, &digest ) );
+	QVERIFY( !ManifestDiff::parseLine( "012  x", &path, &digest ) );
+	QVERIFY( !ManifestDiff::parseLine( "0102  ", &path, &digest ) );
+	QVERIFY( !ManifestDiff::parseLine( "just some text", &path, &digest ) );
+}
+
+void TestEngine::manifestDiff_data()
+{
+	QTest::addColumn<qint64>( "memory" );
+	QTest::addColumn<int>( "count" );
+
+	QTest::newRow( "memory" ) << qint64( 256 * 1024 * 1024 ) << 5000;
+	QTest::newRow( "spilled" ) << qint64( 1 ) << 5000;
+	// Runs of 1024 records, more than one merge pass can take.
+	QTest::newRow( "multi-pass" ) << qint64( 1 ) << 100000;
+}
+
+void TestEngine::manifestDiff()
+{
+	QFETCH( qint64, memory );
+	QFETCH( int, count );
+
+	// The before manifest in coreutils format, the after one in BSD format.
+	QByteArray before = "# written by hand\n";
+	QByteArray after;
+	auto digest = []( int i ) { return Reference::randomData( 32, quint32( i ) ).toHex(); };
+	for( int i = 0; i < count; i++ ) {
+		const QByteArray path = "dir" + QByteArray::number( i % 7 ) + "/file" + QByteArray::number( i );
+		before += digest( i ) + "  " + path + "\n";
+		if( i < 10 )
+			continue; // removed
+		else if( i < 20 )
+			after += "SHA256 (" + path + ") = " + digest( i + count ) + "\r\n"; // modified
+		else if( i < 30 )
+			after += "SHA256 (moved/" + QByteArray::number( i ) + ") = " + digest( i ) + "\n";
+		else
+			after += "SHA256 (" + path + ") = " + digest( i ) + "\n";
+	}
+	for( int i = 0; i < 10; i++ )
+		after += "\\SHA256 (new\\n" + QByteArray::number( i ) + ") = " + digest( 2 * count + i ) + "\n";
+	// Duplicate lines count once.
+	after += "SHA256 (dir2/file100) = " + digest( 100 ) + "\n";
+
+	QTemporaryDir manifestDir;
+	QVERIFY( manifestDir.isValid() );
+	const QString beforeName = manifestDir.filePath( "before.sha256" );
+	const QString afterName = manifestDir.filePath( "after.sha256" );
+	for( const auto &entry : { qMakePair( beforeName, before ), qMakePair( afterName, after ) } ) {
+		QFile file( entry.first );
+		QVERIFY( file.open( QIODevice::WriteOnly ) );
+		file.write( entry.second );
+	}
+
+	QMap<QString, QString> changes;
+	ManifestDiff diff;
+	diff.setMemoryBudget( memory );
+	const bool ok = diff.run( beforeName, afterName,
+			[&changes]( ManifestDiff::Change change, const QString &path, const QString &oldPath ) {
+		const char *const codes[] = { "A", "D", "M", "R" };
+		changes.insert( path, codes[change] + (oldPath.isEmpty() ? QString() : " " + oldPath) );
+	} );
+	QVERIFY2( ok, qPrintable( diff.errorString() ) );
+
+	const ManifestDiff::Stats stats = diff.stats();
+	QCOMPARE( stats.before, quint64( count ) );
+	QCOMPARE( stats.after, quint64( count - 10 + 10 + 1 ) );
+	QCOMPARE( stats.unchanged, quint64( count - 30 ) );
+	QCOMPARE( stats.added, quint64( 10 ) );
+	QCOMPARE( stats.removed, quint64( 10 ) );
+	QCOMPARE( stats.modified, quint64( 10 ) );
+	QCOMPARE( stats.moved, quint64( 10 ) );
+	QCOMPARE( changes.size(), 40 );
+	QCOMPARE( changes.value( "dir0/file7" ), QString( "D" ) );
+	QCOMPARE( changes.value( "dir1/file15" ), QString( "M" ) );
+	QCOMPARE( changes.value( "moved/21" ), QString( "R dir0/file21" ) );
+	QCOMPARE( changes.value( "new\n3" ), QString( "A" ) );
+}
+
+void TestEngine::manifestDiffError()
+{
+	// Blank lines count, the error names the line as an editor shows it.
+	QTemporaryDir manifestDir;
+	QVERIFY( manifestDir.isValid() );
+	const QString beforeName = manifestDir.filePath( "before.sha256" );
+	const QString afterName = manifestDir.filePath( "after.sha256" );
+	for( const auto &entry : { qMakePair( beforeName, QByteArray( "0102  a\n\n\r\n0304  b\nbogus\n" ) ),
+							   qMakePair( afterName, QByteArray( "0102  a\n" ) ) } ) {
+		QFile file( entry.first );
+		QVERIFY( file.open( QIODevice::WriteOnly ) );
+		file.write( entry.second );
+	}
+
+	ManifestDiff diff;
+	QVERIFY( !diff.run( beforeName, afterName, []( ManifestDiff::Change, const QString &, const QString & ) {} ) );
+	QCOMPARE( diff.errorString(), beforeName + ":5: not a checksum line" );
+}
+
+QTEST_GUILESS_MAIN( TestEngine )
+#include "tst_engine.moc"
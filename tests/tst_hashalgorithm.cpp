@@ -0,0 +1,214 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QTemporaryFile>
+
+#include "hashalgorithm.h"
+#include "cihash.h"
+#include "reference.h"
+
+#define READ_SIZE (1024 * 1024)
+
+namespace {
+
+const char *const ABC = "abc";
+const char *const ABC56 = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+struct Vector
+{
+	const char *algorithm;
+	QByteArray message;
+	const char *digest;
+};
+
+// Published test vectors (RFC 1321, FIPS 180-2 and NIST examples).
+QVector<Vector> testVectors()
+{
+	const QByteArray million( 1000000, 'a' );
+	return QVector<Vector> {
+		{ "md5", "", "d41d8cd98f00b204e9800998ecf8427e" },
+		{ "md5", ABC, "900150983cd24fb0d6963f7d28e17f72" },
+		{ "md5", ABC56, "8215ef0796a20bcaaae116d3876c664a" },
+		{ "md5", million, "7707d6ae4e027c70eea2a935c2296f21" },
+		{ "sha1", "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+		{ "sha1", ABC, "a9993e364706816aba3e25717850c26c9cd0d89d" },
+		{ "sha1", ABC56, "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+		{ "sha1", million, "34aa973cd4c4daa4f61eeb2bdbad27316534016f" },
+		{ "sha224", "", "d14a028c2a3a2bc9476102bb288234c415a2b01f828ea62ac5b3e42f" },
+		{ "sha224", ABC, "23097d223405d8228642a477bda255b32aadbce4bda0b3f7e36c9da7" },
+		{ "sha224", ABC56, "75388b16512776cc5dba5da1fd890150b0c6455cb4f58b1952522525" },
+		{ "sha224", million, "20794655980c91d8bbb4c1ea97618a4bf03f42581948b2ee4ee7ad67" },
+		{ "sha256", "", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" },
+		{ "sha256", ABC, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+		{ "sha256", ABC56, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" },
+		{ "sha256", million, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" },
+		{ "sha384", "", "38b060a751ac96384cd9327eb1b1e36a21fdb71114be07434c0cc7bf63f6e1da"
+						"274edebfe76f65fbd51ad2f14898b95b" },
+		{ "sha384", ABC, "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded1631a8b605a43ff5bed"
+						 "8086072ba1e7cc2358baeca134c825a7" },
+		{ "sha384", ABC56, "3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05abfe8f450de5f36bc6"
+						   "b0455a8520bc4e6f5fe95b1fe3c8452b" },
+		{ "sha384", million, "9d0e1809716474cb086e834e310a4a1ced149e9c00f248527972cec5704c2a5b"
+							 "07b8b3dc38ecc4ebae97ddd87f3d8985" },
+		{ "sha512", "", "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
+						"47d0d13c5d85f2b0ff8318d2877eec2f63b931bd47417a81a538327af927da3e" },
+		{ "sha512", ABC, "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+						 "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f" },
+		{ "sha512", ABC56, "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228a8279be331a703c335"
+						   "96fd15c13b1b07f9aa1d3bea57789ca031ad85c7a71dd70354ec631238ca3445" },
+		{ "sha512", million, "e718483d0ce769644e2e42c7bc15b4638e1f98b13b2044285632a803afa973eb"
+							 "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b" },
+	};
+}
+
+const char *backendName( IOBackend backend )
+{
+	return backend == IOBackend::Mapped ? "mapped" : "stream";
+}
+
+} // namespace
+
+class TestHashAlgorithm : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void registry();
+	void vectors_data();
+	void vectors();
+	void edgeSizes_data();
+	void edgeSizes();
+	void cihash();
+	void sparseFile();
+};
+
+void TestHashAlgorithm::registry()
+{
+	QSet<QString> names;
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		QVERIFY2( !names.contains( algo.name ), qPrintable( algo.name ) );
+		names.insert( algo.name );
+		QVERIFY( algo.digestSize > 0 );
+		for( HashAlgorithm::Kernel kernel : algo.kernels )
+			QVERIFY( kernel );
+		QVERIFY( algo.bufferKernel );
+		QCOMPARE( HashAlgorithm::find( algo.label ), &algo );
+	}
+	QVERIFY( HashAlgorithm::defaultAlgorithm() );
+	QVERIFY( !HashAlgorithm::find( "nonexistent" ) );
+
+	// Every registered algorithm has to come with test vectors.
+	QSet<QString> covered;
+	for( const Vector &v : testVectors() )
+		covered.insert( v.algorithm );
+	QCOMPARE( covered, names );
+}
+
+void TestHashAlgorithm::vectors_data()
+{
+	QTest::addColumn<QString>( "algorithm" );
+	QTest::addColumn<QByteArray>( "message" );
+	QTest::addColumn<QByteArray>( "digest" );
+	QTest::addColumn<int>( "backend" );
+
+	for( const Vector &v : testVectors() ) {
+		for( IOBackend backend : { IOBackend::Stream, IOBackend::Mapped } ) {
+			QTest::addRow( "%s-%d-%s", v.algorithm, int( v.message.size() ), backendName( backend ) )
+				<< QString( v.algorithm ) << v.message << QByteArray( v.digest ) << int( backend );
+		}
+	}
+}
+
+void TestHashAlgorithm::vectors()
+{
+	QFETCH( QString, algorithm );
+	QFETCH( QByteArray, message );
+	QFETCH( QByteArray, digest );
+	QFETCH( int, backend );
+
+	const HashAlgorithm *algo = HashAlgorithm::find( algorithm );
+	QVERIFY( algo );
+
+	// A buffer is no file, the mapped backend has to fall back to streaming.
+	QBuffer buffer( &message );
+	QVERIFY( buffer.open( QIODevice::ReadOnly ) );
+	QCOMPARE( algo->hash( &buffer, nullptr, IOBackend( backend ) ).toHex(), digest );
+}
+
+void TestHashAlgorithm::edgeSizes_data()
+{
+	QTest::addColumn<QString>( "algorithm" );
+	QTest::addColumn<int>( "size" );
+
+	const int sizes[] = { 0, 1, 55, 56, 63, 64, 65, 111, 112, 127, 128, 129,
+						  READ_SIZE - 1, READ_SIZE, READ_SIZE + 1, 3 * READ_SIZE + 17 };
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		for( int size : sizes )
+			QTest::addRow( "%s-%d", qPrintable( algo.name ), size ) << algo.name << size;
+	}
+}
+
+void TestHashAlgorithm::edgeSizes()
+{
+	QFETCH( QString, algorithm );
+	QFETCH( int, size );
+
+	const HashAlgorithm *algo = HashAlgorithm::find( algorithm );
+	const QByteArray data = Reference::randomData( size, quint32( size ) );
+	const QByteArray expected = Reference::digest( algorithm, data );
+
+	QTemporaryFile file;
+	QVERIFY( file.open() );
+	QCOMPARE( file.write( data ), qint64( size ) );
+	QVERIFY( file.flush() );
+
+	// Every backend has to produce the digest of the plain path.
+	for( IOBackend backend : { IOBackend::Stream, IOBackend::Mapped } ) {
+		QVERIFY( file.seek( 0 ) );
+		QCOMPARE( algo->hash( &file, nullptr, backend ), expected );
+	}
+
+	// Twice, the reused context must not carry state over.
+	QCOMPARE( algo->hashBuffer( data.constData(), data.size() ), expected );
+	QCOMPARE( algo->hashBuffer( data.constData(), data.size() ), expected );
+}
+
+void TestHashAlgorithm::cihash()
+{
+	const QByteArray data = Reference::randomData( 2 * READ_SIZE + 5, 42 );
+
+	QTemporaryFile tmp;
+	QVERIFY( tmp.open() );
+	tmp.write( data );
+	tmp.close();
+
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		for( IOBackend backend : { IOBackend::Stream, IOBackend::Mapped } ) {
+			CIHash hash( nullptr, &algo, backend );
+			hash.setInput( new QFile( tmp.fileName() ) );
+			hash.start();
+			QVERIFY( hash.wait( 60000 ) );
+			QCOMPARE( hash.result(), Reference::digest( algo.name, data ) );
+		}
+	}
+}
+
+void TestHashAlgorithm::sparseFile()
+{
+	if( qEnvironmentVariableIsEmpty( "INSANESUMS_TEST_LARGE" ) )
+		QSKIP( "Set INSANESUMS_TEST_LARGE or configure with INSANESUMS_LARGE_TESTS." );
+
+	// 3 GiB + 1 zero bytes, crosses the 32 bit boundary of sizes and offsets.
+	QTemporaryFile file;
+	QVERIFY( file.open() );
+	QVERIFY( file.resize( Q_INT64_C( 3 ) * 1024 * 1024 * 1024 + 1 ) );
+
+	const HashAlgorithm *algo = HashAlgorithm::find( "sha256" );
+	for( IOBackend backend : { IOBackend::Stream, IOBackend::Mapped } ) {
+		QVERIFY( file.seek( 0 ) );
+		QCOMPARE( algo->hash( &file, nullptr, backend ).toHex(),
+				  QByteArray( "1527e02d5eba58a7c897e19f16ce73792d2aca31c036d878d437e05b2aec3b0f" ) );
+	}
+}
+
+QTEST_GUILESS_MAIN( TestHashAlgorithm )
+#include "tst_hashalgorithm.moc"
@@ -0,0 +1,196 @@
+#include <QtTest/QtTest>
+#include <QtCore/QBuffer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QTextStream>
+
+#include "hashalgorithm.h"
+#include "chunker.h"
+#include "manifestwriter.h"
+#include "reference.h"
+
+#define DEFAULT_SIZE_MB 256
+#define RUNS 3
+
+/**
+ * Throughput smoke tests. Every measurement is compared against the
+ * baseline file given in INSANESUMS_PERF_BASELINE and fails if it drops
+ * more than INSANESUMS_PERF_TOLERANCE percent below it. Running with
+ * INSANESUMS_PERF_UPDATE=1 writes the measured values back instead.
+ */
+class TestThroughput : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+	void hashing_data();
+	void hashing();
+	void chunking();
+	void manifest_data();
+	void manifest();
+
+private:
+	QByteArray data;
+	QTemporaryFile file;
+	QMap<QString, double> baseline;
+	QMap<QString, double> measured;
+	double tolerance = 20.0;
+	bool update = false;
+
+	void check( const QString &key, double mbps );
+};
+
+void TestThroughput::initTestCase()
+{
+	const int sizeMb = qEnvironmentVariableIntValue( "INSANESUMS_PERF_SIZE_MB" ) > 0
+			? qEnvironmentVariableIntValue( "INSANESUMS_PERF_SIZE_MB" ) : DEFAULT_SIZE_MB;
+	data = Reference::randomData( qsizetype( sizeMb ) * 1024 * 1024, 1 );
+
+	QVERIFY( file.open() );
+	QCOMPARE( file.write( data ), qint64( data.size() ) );
+	QVERIFY( file.flush() );
+
+	if( !qEnvironmentVariableIsEmpty( "INSANESUMS_PERF_TOLERANCE" ) )
+		tolerance = qEnvironmentVariable( "INSANESUMS_PERF_TOLERANCE" ).toDouble();
+	update = !qEnvironmentVariableIsEmpty( "INSANESUMS_PERF_UPDATE" );
+
+	// Lines of "<name> <MB/s>", '#' starts a comment.
+	QFile in( qEnvironmentVariable( "INSANESUMS_PERF_BASELINE" ) );
+	if( in.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
+		QTextStream stream( &in );
+		QString line;
+		while( stream.readLineInto( &line ) ) {
+			line = line.section( '#', 0, 0 ).simplified();
+			const QStringList fields = line.split( ' ' );
+			if( fields.size() == 2 )
+				baseline.insert( fields.at( 0 ), fields.at( 1 ).toDouble() );
+		}
+	}
+}
+
+void TestThroughput::cleanupTestCase()
+{
+	if( !update )
+		return;
+
+	QFile out( qEnvironmentVariable( "INSANESUMS_PERF_BASELINE" ) );
+	QVERIFY( out.open( QIODevice::WriteOnly | QIODevice::Text ) );
+	QTextStream stream( &out );
+	stream << "# Throughput baseline in MB/s, written by tst_throughput with INSANESUMS_PERF_UPDATE=1.\n";
+	for( auto it = measured.constBegin(); it != measured.constEnd(); ++it )
+		stream << it.key() << ' ' << QString::number( it.value(), 'f', 0 ) << '\n';
+}
+
+void TestThroughput::check( const QString &key, double mbps )
+{
+	measured.insert( key, mbps );
+	qInfo( "%s: %.0f MB/s", qPrintable( key ), mbps );
+	if( update || !baseline.contains( key ) )
+		return;
+
+	const double floor = baseline.value( key ) * (1.0 - tolerance / 100.0);
+	QVERIFY2( mbps >= floor, qPrintable( QString( "%1 MB/s is below %2 MB/s (baseline %3 MB/s, tolerance %4%)" )
+			.arg( mbps, 0, 'f', 0 ).arg( floor, 0, 'f', 0 ).arg( baseline.value( key ) ).arg( tolerance ) ) );
+}
+
+void TestThroughput::hashing_data()
+{
+	QTest::addColumn<QString>( "algorithm" );
+	QTest::addColumn<int>( "backend" );
+
+	for( const HashAlgorithm &algo : HashAlgorithm::all() ) {
+		QTest::addRow( "%s-stream", qPrintable( algo.name ) ) << algo.name << int( IOBackend::Stream );
+		QTest::addRow( "%s-mapped", qPrintable( algo.name ) ) << algo.name << int( IOBackend::Mapped );
+	}
+}
+
+void TestThroughput::hashing()
+{
+	QFETCH( QString, algorithm );
+	QFETCH( int, backend );
+
+	const HashAlgorithm *algo = HashAlgorithm::find( algorithm );
+
+	// Best of a few runs, the file is in the page cache after the first.
+	qint64 best = std::numeric_limits<qint64>::max();
+	for( int run = 0; run < RUNS; run++ ) {
+		QVERIFY( file.seek( 0 ) );
+		QElapsedTimer timer;
+		timer.start();
+		const QByteArray digest = algo->hash( &file, nullptr, IOBackend( backend ) );
+		best = qMin( best, timer.nsecsElapsed() );
+		QCOMPARE( digest.size(), algo->digestSize );
+	}
+
+	const double mbps = data.size() / (1024.0 * 1024.0) / (best / 1e9);
+	check( QString( QTest::currentDataTag() ), mbps );
+}
+
+void TestThroughput::chunking()
+{
+	GearChunker chunker( ChunkerParams() );
+	const uchar *p = (const uchar*)data.constData();
+	const std::size_t size = std::size_t( data.size() );
+
+	qint64 best = std::numeric_limits<qint64>::max();
+	for( int run = 0; run < RUNS; run++ ) {
+		QElapsedTimer timer;
+		timer.start();
+		std::size_t pos = 0;
+		while( pos < size )
+			pos += chunker.cut( p + pos, size - pos );
+		best = qMin( best, timer.nsecsElapsed() );
+	}
+
+	check( "fastcdc", size / (1024.0 * 1024.0) / (best / 1e9) );
+}
+
+void TestThroughput::manifest_data()
+{
+	QTest::addColumn<bool>( "sorted" );
+
+	QTest::newRow( "manifest" ) << false;
+	QTest::newRow( "manifest-sorted" ) << true;
+}
+
+void TestThroughput::manifest()
+{
+	QFETCH( bool, sorted );
+
+	// A million distinct results with realistic paths, written as
+	// coreutils lines in ten batches. Building a batch is not timed.
+	QVector<HashResult> results( 100000 );
+	auto fill = [&results]( int run ) {
+		for( int i = 0; i < results.size(); i++ ) {
+			const int index = run * results.size() + i;
+			const quint32 n = quint32( index ) * 2654435761u;
+			results[i] = HashResult { QString( "/srv/data/dir%1/sub%2/file-%3.dat" ).arg( n % 97 ).arg( n % 1013 ).arg( index ),
+									  qint64( n % 100000 ), Reference::randomData( 32, n ) };
+		}
+	};
+
+	QTemporaryFile out;
+	QVERIFY( out.open() );
+	QElapsedTimer timer;
+	qint64 elapsed = 0;
+	ManifestWriter writer( HashAlgorithm::find( "sha256" ), ManifestWriter::CoreutilsFormat );
+	writer.setSorted( sorted );
+	QVERIFY( writer.open( out.fileName() ) );
+	for( int run = 0; run < 10; run++ ) {
+		fill( run );
+		timer.start();
+		QVERIFY( writer.write( results ) );
+		elapsed += timer.nsecsElapsed();
+	}
+	timer.start();
+	QVERIFY( writer.close() );
+	elapsed += timer.nsecsElapsed();
+
+	QCOMPARE( writer.writtenCount(), quint64( 10 * results.size() ) );
+	check( QString( QTest::currentDataTag() ), QFileInfo( out.fileName() ).size() / (1024.0 * 1024.0) / (elapsed / 1e9) );
+}
+
+QTEST_GUILESS_MAIN( TestThroughput )
+#include "tst_throughput.moc"